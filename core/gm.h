@@ -0,0 +1,17 @@
+#ifndef GM_H
+#define GM_H
+
+// gm core: graph topology (and locality orderings), belief propagation
+// (optionally on compact storage), junction trees, CRF energies, datasets
+// and multi-process training pools, on raw buffers, with no dependency on
+// Lua or TH. The Lua package (libgm) is a thin binding on top of these.
+
+#include "gm_graph.h"
+#include "gm_compact.h"
+#include "gm_infer.h"
+#include "gm_junction.h"
+#include "gm_energies.h"
+#include "gm_dataset.h"
+#include "gm_parallel.h"
+
+#endif
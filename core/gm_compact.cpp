@@ -0,0 +1,224 @@
+#include "gm_compact.h"
+
+#include <math.h>
+#include <string.h>
+
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
+namespace gm {
+
+uint16_t floatToHalf(float x) {
+#ifdef __F16C__
+  return _cvtss_sh(x, 0);
+#else
+  uint32_t f;
+  memcpy(&f, &x, sizeof(f));
+  uint16_t sign = (f >> 16) & 0x8000;
+  int exponent = (int)((f >> 23) & 0xff) - 127 + 15;
+  uint32_t mantissa = f & 0x7fffff;
+
+  // inf and nan
+  if (((f >> 23) & 0xff) == 0xff) return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+
+  // overflow
+  if (exponent >= 0x1f) return sign | 0x7c00;
+
+  // subnormals, and underflow
+  if (exponent <= 0) {
+    if (exponent < -10) return sign;
+    mantissa |= 0x800000;
+    int shift = 14 - exponent;
+    uint32_t h = mantissa >> shift;
+    uint32_t rest = mantissa & ((1u << shift) - 1);
+    uint32_t halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (h & 1))) h++;
+    return sign | h;
+  }
+
+  // normals (a carry out of the mantissa correctly bumps the exponent)
+  uint32_t h = ((uint32_t)exponent << 10) | (mantissa >> 13);
+  uint32_t rest = mantissa & 0x1fff;
+  if (rest > 0x1000 || (rest == 0x1000 && (h & 1))) h++;
+  return sign | h;
+#endif
+}
+
+float halfToFloat(uint16_t h) {
+#ifdef __F16C__
+  return _cvtsh_ss(h);
+#else
+  uint32_t sign = (uint32_t)(h & 0x8000) << 16;
+  uint32_t exponent = (h >> 10) & 0x1f;
+  uint32_t mantissa = h & 0x3ff;
+
+  // subnormals: mantissa * 2^-24
+  if (exponent == 0) {
+    float x = mantissa * 5.9604644775390625e-8f;
+    return sign ? -x : x;
+  }
+
+  uint32_t f;
+  if (exponent == 0x1f) f = sign | 0x7f800000 | (mantissa << 13);
+  else f = sign | ((exponent + 127 - 15) << 23) | (mantissa << 13);
+  float x;
+  memcpy(&x, &f, sizeof(x));
+  return x;
+#endif
+}
+
+// log codes of one edge table
+template <typename code, typename real>
+static void encodeLog(const real *table, long nS1, long nS2, long maxStates,
+                      long levels, float *offset, float *scale, code *codes) {
+  // range of log(pot) over the nonzero entries
+  double lo = HUGE_VAL, hi = -HUGE_VAL;
+  for (long i = 0; i < nS1; i++) {
+    for (long j = 0; j < nS2; j++) {
+      real p = table[i*maxStates+j];
+      if (p > 0) {
+        double l = log(p);
+        if (l < lo) lo = l;
+        if (l > hi) hi = l;
+      }
+    }
+  }
+  if (lo > hi) lo = hi = 0;
+  *offset = lo;
+  *scale = (hi - lo) / (levels - 1);
+
+  // round to the nearest code, against the stored (float) offset/scale
+  for (long i = 0; i < nS1; i++) {
+    for (long j = 0; j < nS2; j++) {
+      real p = table[i*maxStates+j];
+      long c = 0;
+      if (p > 0) {
+        c = 1;
+        if (*scale > 0) {
+          c += lround((log(p) - *offset) / *scale);
+          if (c < 1) c = 1;
+          if (c > levels) c = levels;
+        }
+      }
+      codes[i*maxStates+j] = c;
+    }
+  }
+}
+
+template <typename code, typename real>
+static inline void decodeLog(const code *codes, long nS1, long nS2,
+                             long maxStates, real offset, real scale,
+                             real *table) {
+  // small tables: one exp per entry
+  long nHi = sizeof(code) > 1 ? 256 : 1;
+  if (nS1*nS2 <= nHi+256) {
+    for (long i = 0; i < nS1; i++) {
+      for (long j = 0; j < nS2; j++) {
+        code c = codes[i*maxStates+j];
+        table[i*maxStates+j] = c ? exp(offset + (c-1)*scale) : 0;
+      }
+    }
+    return;
+  }
+
+  // large tables: with c-1 = 256*hi + lo, pot = exp(offset + 256*hi*scale)
+  // * exp(lo*scale), from one exp per value of hi and lo
+  real hi[256], lo[256];
+  for (long k = 0; k < nHi; k++) hi[k] = exp(offset + 256*k*scale);
+  for (long k = 0; k < 256; k++) lo[k] = exp(k*scale);
+  for (long i = 0; i < nS1; i++) {
+    for (long j = 0; j < nS2; j++) {
+      long c = codes[i*maxStates+j];
+      table[i*maxStates+j] = c ? hi[(c-1) >> 8] * lo[(c-1) & 255] : 0;
+    }
+  }
+}
+
+template <typename real>
+void compactPotentials(const Graph<real> &g, const real *edgePot,
+                       int storage, CompactPotentials &pot) {
+  long nEdges = g.nEdges;
+  long maxStates = g.maxStates;
+  long tableSize = maxStates*maxStates;
+  const real *nStates = g.nStates;
+  const real *edgeEnds = g.edgeEnds;
+
+  // 16-bit words, or pairs of 8-bit codes
+  pot.storage = storage;
+  pot.nEdges = nEdges;
+  pot.maxStates = maxStates;
+  if (storage == kStorageLog8) pot.data.assign((nEdges*tableSize+1)/2, 0);
+  else pot.data.assign(nEdges*tableSize, 0);
+  pot.offset.assign(nEdges, 0);
+  if (storage == kStorageHalf) pot.scale.clear();
+  else pot.scale.assign(nEdges, 0);
+  uint16_t *words = pot.data.empty() ? NULL : &pot.data[0];
+  uint8_t *bytes = (uint8_t *)words;
+
+#pragma omp parallel for
+  for (long e = 0; e < nEdges; e++) {
+    long nS1 = nStates[(long)edgeEnds[e*2+0]-1];
+    long nS2 = nStates[(long)edgeEnds[e*2+1]-1];
+    const real *table = edgePot + e*tableSize;
+    if (storage == kStorageHalf) {
+      // values relative to the largest one (against the stored, float,
+      // offset), keeping nonzero entries nonzero
+      uint16_t *codes = words + e*tableSize;
+      real top = 0;
+      for (long i = 0; i < nS1; i++) {
+        for (long j = 0; j < nS2; j++) {
+          if (table[i*maxStates+j] > top) top = table[i*maxStates+j];
+        }
+      }
+      pot.offset[e] = top > 0 ? log(top) : 0;
+      double norm = exp(-(double)pot.offset[e]);
+      for (long i = 0; i < nS1; i++) {
+        for (long j = 0; j < nS2; j++) {
+          float x = table[i*maxStates+j] * norm;
+          uint16_t h = floatToHalf(x);
+          if (h == 0 && x > 0) h = 1;
+          codes[i*maxStates+j] = h;
+        }
+      }
+    } else if (storage == kStorageLog16) {
+      encodeLog(table, nS1, nS2, maxStates, 65535, &pot.offset[e],
+                &pot.scale[e], words + e*tableSize);
+    } else {
+      encodeLog(table, nS1, nS2, maxStates, 255, &pot.offset[e],
+                &pot.scale[e], bytes + e*tableSize);
+    }
+  }
+}
+
+template <typename real>
+void expandPotentials(const CompactPotentials &pot, long e, long nS1,
+                      long nS2, real *table) {
+  long maxStates = pot.maxStates;
+  long base = e*maxStates*maxStates;
+  const uint16_t *words = &pot.data[0];
+  if (pot.storage == kStorageHalf) {
+    const uint16_t *codes = words + base;
+    real top = exp((real)pot.offset[e]);
+    for (long i = 0; i < nS1; i++) {
+      for (long j = 0; j < nS2; j++) {
+        table[i*maxStates+j] = halfToFloat(codes[i*maxStates+j]) * top;
+      }
+    }
+  } else if (pot.storage == kStorageLog16) {
+    decodeLog(words + base, nS1, nS2, maxStates, (real)pot.offset[e],
+              (real)pot.scale[e], table);
+  } else {
+    decodeLog((const uint8_t *)words + base, nS1, nS2, maxStates,
+              (real)pot.offset[e], (real)pot.scale[e], table);
+  }
+}
+
+#define GM_INSTANTIATE(real) \
+  template void compactPotentials<real>(const Graph<real> &, const real *, int, CompactPotentials &); \
+  template void expandPotentials<real>(const CompactPotentials &, long, long, long, real *);
+
+GM_INSTANTIATE(float)
+GM_INSTANTIATE(double)
+
+}
@@ -0,0 +1,52 @@
+#ifndef GM_COMPACT_H
+#define GM_COMPACT_H
+
+#include <stdint.h>
+#include <vector>
+
+#include "gm_graph.h"
+
+namespace gm {
+
+// Compact storage for edge potentials, for graphs where edgePot dominates
+// memory and bandwidth. Tables are only decoded, one edge at a time, by
+// the kernels that read them; all arithmetic stays in float/double.
+//   kStorageHalf:  fp16 values, relative to a per-edge scale
+//   kStorageLog16: 16-bit codes of log(pot), with a per-edge offset/scale
+//   kStorageLog8:  8-bit codes of log(pot), with a per-edge offset/scale
+// Half values are pot = exp(offset) * half, with exp(offset) the largest
+// entry of the table, so exp(score) potentials can't overflow fp16, and
+// nonzero entries too small for fp16 are kept at its smallest subnormal.
+// Log codes are pot = exp(offset + (code-1)*scale). In both, code 0 is an
+// exact 0, so hard constraints survive quantization.
+enum Storage { kStorageHalf = 1, kStorageLog16 = 2, kStorageLog8 = 3 };
+
+struct CompactPotentials {
+  int storage;
+  long nEdges;
+  long maxStates;
+  std::vector<uint16_t> data; // E x maxStates x maxStates codes (8-bit
+                              // codes are packed two per word)
+  std::vector<float> offset;  // E
+  std::vector<float> scale;   // E, log-quantized storages only
+};
+
+// IEEE half precision conversions (round to nearest even).
+uint16_t floatToHalf(float x);
+float halfToFloat(uint16_t h);
+
+// Encodes edgePot (E x maxStates x maxStates) with the given storage.
+template <typename real>
+void compactPotentials(const Graph<real> &g, const real *edgePot,
+                       int storage, CompactPotentials &pot);
+
+// Decodes the nS1 x nS2 table of edge e into table (row stride maxStates).
+// Large log-quantized tables go through per-edge tables of exp() values,
+// so that decoding costs about one multiply per entry.
+template <typename real>
+void expandPotentials(const CompactPotentials &pot, long e, long nS1,
+                      long nS2, real *table);
+
+}
+
+#endif
@@ -0,0 +1,290 @@
+#include "gm_dataset.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace gm {
+
+static const char kMagic[8] = {'g','m','d','a','t','a',0,0};
+static const long kAlign = 64;
+
+static inline long align(long offset) {
+  return (offset + kAlign-1) & ~(kAlign-1);
+}
+
+// size in bytes of a per-instance topology record
+static inline long recordSize(const DatasetHeader &h, long nNodes, long nEdges) {
+  return h.realSize * (nNodes + h.nNodeFeatures*nNodes
+                       + h.nEdgeFeatures*nEdges + 2*nEdges);
+}
+
+// true if count items of itemSize bytes, from offset, lie inside a file
+// of size bytes (counts come from the file, so products are taken in
+// double to avoid overflowing)
+static inline bool inside(int64_t offset, double count, long itemSize, long size) {
+  return offset >= 0 && count >= 0 && offset + count*itemSize <= size;
+}
+
+DatasetWriter::DatasetWriter() : fd(-1), nAdded(0), end(0) {
+}
+
+DatasetWriter::~DatasetWriter() {
+  if (fd >= 0) ::close(fd);
+}
+
+bool DatasetWriter::write(const void *data, long size, long offset) {
+  const char *p = (const char *)data;
+  while (size > 0) {
+    ssize_t n = pwrite(fd, p, size, offset);
+    if (n < 0) {
+      if (errno == EINTR) continue;
+      err = std::string("write failed: ") + strerror(errno);
+      return false;
+    }
+    p += n; size -= n; offset += n;
+  }
+  return true;
+}
+
+bool DatasetWriter::open(const char *filename, long realSize, long nInstances,
+                         long nNodes, long nEdges, long nNodeFeatures,
+                         long nEdgeFeatures, bool topology) {
+  if (realSize != 4 && realSize != 8) {
+    err = "reals must be 4 or 8 bytes";
+    return false;
+  }
+  fd = ::open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) {
+    err = std::string("can't open ") + filename + ": " + strerror(errno);
+    return false;
+  }
+
+  // header
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.version = 1;
+  header.realSize = realSize;
+  header.flags = topology ? kDatasetTopology : 0;
+  header.nInstances = nInstances;
+  header.nNodes = nNodes;
+  header.nEdges = nEdges;
+  header.nNodeFeatures = nNodeFeatures;
+  header.nEdgeFeatures = nEdgeFeatures;
+
+  // layout
+  if (topology) {
+    header.offsetIndex = align(sizeof(header));
+    end = align(header.offsetIndex + nInstances*3*sizeof(int64_t));
+  } else {
+    header.offsetY = align(sizeof(header));
+    header.offsetXnode = align(header.offsetY + nInstances*nNodes*realSize);
+    header.offsetXedge = align(header.offsetXnode + nInstances*nNodeFeatures*nNodes*realSize);
+    end = header.offsetXedge + nInstances*nEdgeFeatures*nEdges*realSize;
+    if (ftruncate(fd, end) != 0) {
+      err = std::string("can't size dataset: ") + strerror(errno);
+      return false;
+    }
+  }
+  nAdded = 0;
+  return write(&header, sizeof(header), 0);
+}
+
+bool DatasetWriter::add(const void *y, const void *Xnode, const void *Xedge,
+                        long nNodes, long nEdges, const void *edgeEnds) {
+  if (fd < 0) {
+    err = "dataset is not open";
+    return false;
+  }
+  if (nAdded >= header.nInstances) {
+    err = "dataset is full";
+    return false;
+  }
+  long rs = header.realSize;
+  long F = header.nNodeFeatures;
+  long Fe = header.nEdgeFeatures;
+  long i = nAdded;
+
+  if (header.flags & kDatasetTopology) {
+    if (nNodes > header.nNodes || nEdges > header.nEdges) {
+      err = "instance is larger than the dataset's nNodes/nEdges";
+      return false;
+    }
+    // record, then its index entry
+    long offset = align(end);
+    int64_t entry[3] = {offset, nNodes, nEdges};
+    if (!write(y, rs*nNodes, offset)) return false;
+    offset += rs*nNodes;
+    if (!write(Xnode, rs*F*nNodes, offset)) return false;
+    offset += rs*F*nNodes;
+    if (!write(Xedge, rs*Fe*nEdges, offset)) return false;
+    offset += rs*Fe*nEdges;
+    if (!write(edgeEnds, rs*2*nEdges, offset)) return false;
+    end = offset + rs*2*nEdges;
+    if (!write(entry, sizeof(entry), header.offsetIndex + i*sizeof(entry))) return false;
+  } else {
+    if (nNodes != header.nNodes || nEdges != header.nEdges) {
+      err = "instance doesn't match the dataset's nNodes/nEdges";
+      return false;
+    }
+    long N = header.nNodes;
+    long E = header.nEdges;
+    if (!write(y, rs*N, header.offsetY + i*rs*N)) return false;
+    if (!write(Xnode, rs*F*N, header.offsetXnode + i*rs*F*N)) return false;
+    if (!write(Xedge, rs*Fe*E, header.offsetXedge + i*rs*Fe*E)) return false;
+  }
+  nAdded++;
+  return true;
+}
+
+bool DatasetWriter::close() {
+  if (fd < 0) return true;
+  bool ok = true;
+  if (nAdded != header.nInstances) {
+    err = "dataset closed before all instances were added";
+    ok = false;
+  }
+  if (::close(fd) != 0 && ok) {
+    err = std::string("close failed: ") + strerror(errno);
+    ok = false;
+  }
+  fd = -1;
+  return ok;
+}
+
+Dataset::Dataset() : base(0), size(0), index(0), refcount(1), prefetching(false) {
+  memset(&header, 0, sizeof(header));
+}
+
+Dataset::~Dataset() {
+  wait();
+  if (base) munmap(base, size);
+}
+
+bool Dataset::open(const char *filename) {
+  int fd = ::open(filename, O_RDONLY);
+  if (fd < 0) {
+    err = std::string("can't open ") + filename + ": " + strerror(errno);
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(header)) {
+    err = std::string(filename) + " is not a gm dataset";
+    ::close(fd);
+    return false;
+  }
+  size = st.st_size;
+  void *p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if (p == MAP_FAILED) {
+    err = std::string("can't map ") + filename + ": " + strerror(errno);
+    return false;
+  }
+  base = (char *)p;
+  memcpy(&header, base, sizeof(header));
+
+  // check header
+  const DatasetHeader &h = header;
+  long rs = h.realSize;
+  bool ok = memcmp(h.magic, kMagic, sizeof(kMagic)) == 0 && h.version == 1
+    && (rs == 4 || rs == 8) && h.nInstances >= 0 && h.nNodes >= 0
+    && h.nEdges >= 0 && h.nNodeFeatures >= 0 && h.nEdgeFeatures >= 0;
+  if (ok && (h.flags & kDatasetTopology)) {
+    // index, then records in order, each one within the file and the
+    // header's maxima
+    ok = h.offsetIndex >= (long)sizeof(header)
+      && inside(h.offsetIndex, 3.0*h.nInstances, sizeof(int64_t), size);
+    index = (const int64_t *)(base + h.offsetIndex);
+    long end = h.offsetIndex + h.nInstances*3*sizeof(int64_t);
+    for (long i = 0; ok && i < h.nInstances; i++) {
+      const int64_t *entry = index + i*3;
+      ok = entry[1] >= 0 && entry[1] <= h.nNodes
+        && entry[2] >= 0 && entry[2] <= h.nEdges && entry[0] >= end
+        && inside(entry[0], recordSize(h, entry[1], entry[2]), 1, size);
+      end = entry[0] + recordSize(h, entry[1], entry[2]);
+    }
+  } else if (ok) {
+    double n = h.nInstances;
+    ok = h.offsetY >= (long)sizeof(header)
+      && inside(h.offsetY, n*h.nNodes, rs, size)
+      && inside(h.offsetXnode, n*h.nNodeFeatures*h.nNodes, rs, size)
+      && inside(h.offsetXedge, n*h.nEdgeFeatures*h.nEdges, rs, size);
+  }
+  if (!ok) {
+    err = std::string(filename) + " is not a valid gm dataset";
+    return false;
+  }
+  return true;
+}
+
+DatasetInstance Dataset::instance(long i) const {
+  const DatasetHeader &h = header;
+  DatasetInstance inst;
+  long rs = h.realSize;
+  if (h.flags & kDatasetTopology) {
+    const int64_t *entry = index + i*3;
+    inst.nNodes = entry[1];
+    inst.nEdges = entry[2];
+    inst.y = entry[0];
+    inst.Xnode = inst.y + rs*inst.nNodes;
+    inst.Xedge = inst.Xnode + rs*h.nNodeFeatures*inst.nNodes;
+    inst.edgeEnds = inst.Xedge + rs*h.nEdgeFeatures*inst.nEdges;
+  } else {
+    inst.nNodes = h.nNodes;
+    inst.nEdges = h.nEdges;
+    inst.y = h.offsetY + i*rs*h.nNodes;
+    inst.Xnode = h.offsetXnode + i*rs*h.nNodeFeatures*h.nNodes;
+    inst.Xedge = h.offsetXedge + i*rs*h.nEdgeFeatures*h.nEdges;
+    inst.edgeEnds = 0;
+  }
+  return inst;
+}
+
+void Dataset::wait() {
+  if (prefetching) {
+    pthread_join(thread, NULL);
+    prefetching = false;
+  }
+}
+
+void *Dataset::prefetchThread(void *arg) {
+  Dataset *ds = (Dataset *)arg;
+  long page = sysconf(_SC_PAGESIZE);
+  volatile char sink = 0;
+  for (size_t r = 0; r < ds->ranges.size(); r++) {
+    long start = ds->ranges[r].first & ~(page-1);
+    long stop = ds->ranges[r].second;
+    madvise(ds->base + start, stop - start, MADV_WILLNEED);
+    for (long p = start; p < stop; p += page) sink += ds->base[p];
+  }
+  return NULL;
+}
+
+void Dataset::prefetch(long first, long count) {
+  wait();
+  const DatasetHeader &h = header;
+  if (first < 0) first = 0;
+  if (first + count > h.nInstances) count = h.nInstances - first;
+  if (count <= 0) return;
+
+  // byte ranges covered by the shard
+  ranges.clear();
+  DatasetInstance a = instance(first);
+  DatasetInstance b = instance(first+count-1);
+  long rs = h.realSize;
+  if (h.flags & kDatasetTopology) {
+    ranges.push_back(std::make_pair(a.y, b.edgeEnds + rs*2*b.nEdges));
+  } else {
+    ranges.push_back(std::make_pair(a.y, b.y + rs*h.nNodes));
+    ranges.push_back(std::make_pair(a.Xnode, b.Xnode + rs*h.nNodeFeatures*h.nNodes));
+    ranges.push_back(std::make_pair(a.Xedge, b.Xedge + rs*h.nEdgeFeatures*h.nEdges));
+  }
+
+  // page in, asynchronously
+  prefetching = pthread_create(&thread, NULL, prefetchThread, this) == 0;
+}
+
+}
@@ -0,0 +1,131 @@
+#ifndef GM_DATASET_H
+#define GM_DATASET_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+
+namespace gm {
+
+// Binary dataset of graph instances, read through mmap. All values are
+// reals (float or double, see realSize), with the layouts used by
+// gm.energies.crf.nll; labels and edge ends are 1-based.
+//
+// With a shared topology, the file holds three blocks, so that any range
+// of instances is a plain view into each of them:
+//   Y:     nInstances x N
+//   Xnode: nInstances x F x N
+//   Xedge: nInstances x Fe x E
+// With per-instance topology (kDatasetTopology), an index of nInstances
+// (offset, nNodes, nEdges) triplets points to one record per instance:
+//   y (n), Xnode (F x n), Xedge (Fe x e), edgeEnds (e x 2)
+// and nNodes/nEdges in the header are maxima over instances.
+// Blocks and records start on 64-byte boundaries.
+
+enum { kDatasetTopology = 1 };
+
+struct DatasetHeader {
+  char magic[8];           // "gmdata\0\0"
+  int64_t version;
+  int64_t realSize;        // 4 or 8
+  int64_t flags;
+  int64_t nInstances;
+  int64_t nNodes;
+  int64_t nEdges;
+  int64_t nNodeFeatures;
+  int64_t nEdgeFeatures;
+  int64_t offsetY;         // shared topology blocks
+  int64_t offsetXnode;
+  int64_t offsetXedge;
+  int64_t offsetIndex;     // per-instance topology index
+  int64_t reserved[3];
+};
+
+// Byte offsets of one instance in the file (edgeEnds is 0 when the
+// topology is shared).
+struct DatasetInstance {
+  long nNodes;
+  long nEdges;
+  long y;
+  long Xnode;
+  long Xedge;
+  long edgeEnds;
+};
+
+// Writes a dataset of nInstances instances, added one at a time, so that
+// the whole set never has to be in memory.
+class DatasetWriter {
+ public:
+  DatasetWriter();
+  ~DatasetWriter();
+
+  bool open(const char *filename, long realSize, long nInstances,
+            long nNodes, long nEdges, long nNodeFeatures,
+            long nEdgeFeatures, bool topology);
+  // Appends one instance; edgeEnds is only used with per-instance topology.
+  bool add(const void *y, const void *Xnode, const void *Xedge,
+           long nNodes, long nEdges, const void *edgeEnds);
+  bool close();
+
+  const DatasetHeader &info() const { return header; }
+  const char *error() const { return err.c_str(); }
+
+ private:
+  bool write(const void *data, long size, long offset);
+
+  int fd;
+  DatasetHeader header;
+  long nAdded;
+  long end;
+  std::string err;
+};
+
+// Read-only view of a dataset file. The mapping is private, so tensors
+// viewing it can be modified in memory without touching the file. open()
+// checks the header and every index entry against the file size, so
+// instance() never points outside the mapping.
+// Datasets are reference counted, as tensor storages may outlive the
+// handle that opened them. A Dataset is not thread-safe: the refcount is
+// a plain counter, and a handle and its views are only used from the
+// thread that opened it (the prefetch thread only reads pages).
+class Dataset {
+ public:
+  Dataset();
+
+  bool open(const char *filename);
+  const DatasetHeader &info() const { return header; }
+  char *data() const { return base; }
+  const char *error() const { return err.c_str(); }
+
+  DatasetInstance instance(long i) const;
+
+  // Pages instances [first, first+count) in from a background thread, so
+  // that the next shard is resident by the time it is trained on: the
+  // thread only touches one byte per page (no copy is made). Waits for the
+  // previous prefetch, if any.
+  void prefetch(long first, long count);
+
+  void retain() { refcount++; }
+  void release() { if (--refcount == 0) delete this; }
+
+ private:
+  ~Dataset();
+  void wait();
+  static void *prefetchThread(void *ds);
+
+  DatasetHeader header;
+  char *base;
+  long size;
+  const int64_t *index;
+  long refcount;
+  std::string err;
+
+  bool prefetching;
+  pthread_t thread;
+  std::vector<std::pair<long,long> > ranges;
+};
+
+}
+
+#endif
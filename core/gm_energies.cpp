@@ -0,0 +1,607 @@
+#include "gm_energies.h"
+#include "gm_infer.h"
+
+#include <math.h>
+#include <vector>
+
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+namespace gm {
+
+// log-potentials of node n: theta[s] = sum_f w[nodeMap] * Xnode
+template <typename real>
+static inline void nodeScores(const Graph<real> &g, long n, const real *Xnode,
+                              long nNodeFeatures, const real *nodeMap,
+                              const real *w, real *theta) {
+  long nNodes = g.nNodes;
+  long maxStates = g.maxStates;
+  for (long s = 0; s < g.nStates[n]; s++) {
+    theta[s] = 0;
+    const real *map = nodeMap + (n*maxStates+s)*nNodeFeatures;
+    for (long f = 0; f < nNodeFeatures; f++) {
+      if (map[f] > 0) {
+        theta[s] += w[(long)map[f]-1]*Xnode[f*nNodes+n];
+      }
+    }
+  }
+}
+
+// features of edge e, into x (F values)
+template <typename real>
+static inline void edgeFeatures(const Graph<real> &g, long e,
+                                const EdgeFeatures<real> &Xedge, real *x) {
+  const real *X = Xedge.X;
+  long nX = Xedge.nX;
+  if (Xedge.recipe == 0) {
+    long nEdges = g.nEdges;
+    for (long f = 0; f < nX; f++) x[f] = X[f*nEdges+e];
+    return;
+  }
+
+  // generated from the node features of both ends
+  long nNodes = g.nNodes;
+  long n1 = g.edgeEnds[e*2+0]-1;
+  long n2 = g.edgeEnds[e*2+1]-1;
+  x[0] = 1;
+  if (Xedge.recipe == kEdgeAbsDiff) {
+    for (long f = 0; f < nX; f++) x[1+f] = fabs(X[f*nNodes+n1] - X[f*nNodes+n2]);
+  } else if (Xedge.recipe == kEdgeConcat) {
+    for (long f = 0; f < nX; f++) {
+      x[1+f] = X[f*nNodes+n1];
+      x[1+nX+f] = X[f*nNodes+n2];
+    }
+  }
+}
+
+// edge features of instance i of a batch
+template <typename real>
+static inline EdgeFeatures<real> instanceFeatures(const Graph<real> &g,
+                                                  const EdgeFeatures<real> &Xedge,
+                                                  long i) {
+  EdgeFeatures<real> xe = Xedge;
+  xe.X += i*Xedge.nX*(Xedge.recipe ? g.nNodes : g.nEdges);
+  return xe;
+}
+
+// log-potentials of edge e given its features x, theta is nStates[n1] x
+// nStates[n2] with row stride maxStates
+template <typename real>
+static inline void edgeScores(const Graph<real> &g, long e, const real *x,
+                              long nEdgeFeatures, const real *edgeMap,
+                              const real *w, real *theta) {
+  long maxStates = g.maxStates;
+  long n1 = g.edgeEnds[e*2+0]-1;
+  long n2 = g.edgeEnds[e*2+1]-1;
+  for (long s1 = 0; s1 < g.nStates[n1]; s1++) {
+    for (long s2 = 0; s2 < g.nStates[n2]; s2++) {
+      real *t = theta + s1*maxStates+s2;
+      const real *map = edgeMap + ((e*maxStates+s1)*maxStates+s2)*nEdgeFeatures;
+      *t = 0;
+      for (long f = 0; f < nEdgeFeatures; f++) {
+        if (map[f] > 0) {
+          *t += w[(long)map[f]-1]*x[f];
+        }
+      }
+    }
+  }
+}
+
+template <typename real>
+void crfMakeNodePotentials(const Graph<real> &g, const real *Xnode,
+                           long nNodeFeatures, const real *nodeMap,
+                           const real *w, real *nodePot) {
+  long nNodes = g.nNodes;
+  long maxStates = g.maxStates;
+  const real *nStates = g.nStates;
+
+  // generate node potentials
+#pragma omp parallel for
+  for (long n = 0; n < nNodes; n++) {
+    real *pot = nodePot + n*maxStates;
+    nodeScores(g, n, Xnode, nNodeFeatures, nodeMap, w, pot);
+    for (long s = 0; s < maxStates; s++) {
+      pot[s] = (s < nStates[n]) ? exp(pot[s]) : 0;
+    }
+  }
+}
+
+template <typename real>
+void crfMakeEdgePotentials(const Graph<real> &g,
+                           const EdgeFeatures<real> &Xedge,
+                           const real *edgeMap, const real *w, real *edgePot) {
+  long nEdges = g.nEdges;
+  long nEdgeFeatures = edgeFeatureCount(Xedge);
+  long maxStates = g.maxStates;
+  const real *nStates = g.nStates;
+  const real *edgeEnds = g.edgeEnds;
+
+  // generate edge potentials
+#pragma omp parallel
+{
+  std::vector<real> x(nEdgeFeatures);
+
+#pragma omp for
+  for (long e = 0; e < nEdges; e++) {
+    long n1 = edgeEnds[e*2+0]-1;
+    long n2 = edgeEnds[e*2+1]-1;
+    real *pot = edgePot + e*maxStates*maxStates;
+    edgeFeatures(g, e, Xedge, &x[0]);
+    edgeScores(g, e, &x[0], nEdgeFeatures, edgeMap, w, pot);
+    for (long s1 = 0; s1 < maxStates; s1++) {
+      for (long s2 = 0; s2 < maxStates; s2++) {
+        real *p = pot + s1*maxStates+s2;
+        *p = (s1 < nStates[n1] && s2 < nStates[n2]) ? exp(*p) : 0;
+      }
+    }
+  }
+}
+}
+
+template <typename real>
+void crfGradWrtNodes(const Graph<real> &g, const real *Xnode,
+                     long nNodeFeatures, const real *nodeMap, const real *y,
+                     const real *nodeBel, real *grad) {
+  long nNodes = g.nNodes;
+  long maxStates = g.maxStates;
+  const real *nStates = g.nStates;
+
+  // compute gradients wrt nodes
+  for (long n = 0; n < nNodes; n++) {
+    long label = (long)y[n]-1;
+    for (long s = 0; s < nStates[n]; s++) {
+      real obs = (s == label) ? 1 : 0;
+      real bel = nodeBel[n*maxStates+s] - obs;
+      for (long f = 0; f < nNodeFeatures; f++) {
+        long map = nodeMap[(n*maxStates+s)*nNodeFeatures+f];
+        if (map > 0) {
+          grad[map-1] += Xnode[f*nNodes+n] * bel;
+        }
+      }
+    }
+  }
+}
+
+template <typename real>
+void crfGradWrtEdges(const Graph<real> &g, const EdgeFeatures<real> &Xedge,
+                     const real *edgeMap, const real *y, const real *edgeBel,
+                     long nParams, real *grad) {
+  long nEdges = g.nEdges;
+  long nEdgeFeatures = edgeFeatureCount(Xedge);
+  long maxStates = g.maxStates;
+  const real *nStates = g.nStates;
+  const real *edgeEnds = g.edgeEnds;
+
+  // partial gradients, one per thread
+#ifdef _OPENMP
+  long maxthreads = omp_get_max_threads();
+#else
+  long maxthreads = 1;
+#endif
+  std::vector<real> grads(maxthreads*nParams, 0);
+
+  // compute gradients wrt edges
+#pragma omp parallel
+{
+#ifdef _OPENMP
+  long id = omp_get_thread_num();
+#else
+  long id = 0;
+#endif
+  real *partial = &grads[id*nParams];
+  std::vector<real> x(nEdgeFeatures);
+
+  // map
+#pragma omp for
+  for (long e = 0; e < nEdges; e++) {
+    long n1 = edgeEnds[e*2+0]-1;
+    long n2 = edgeEnds[e*2+1]-1;
+    long label1 = (long)y[n1]-1;
+    long label2 = (long)y[n2]-1;
+    edgeFeatures(g, e, Xedge, &x[0]);
+    for (long s1 = 0; s1 < nStates[n1]; s1++) {
+      for (long s2 = 0; s2 < nStates[n2]; s2++) {
+        long eb_i = (e*maxStates+s1)*maxStates+s2;
+        real obs = ((s1 == label1) && (s2 == label2)) ? 1 : 0;
+        real bel = edgeBel[eb_i] - obs;
+        for (long f = 0; f < nEdgeFeatures; f++) {
+          long map = edgeMap[eb_i*nEdgeFeatures+f];
+          if (map > 0) {
+            partial[map-1] += x[f] * bel;
+          }
+        }
+      }
+    }
+  }
+}
+
+  // reduce
+  for (long i = 0; i < maxthreads; i++) {
+    for (long p = 0; p < nParams; p++) grad[p] += grads[i*nParams+p];
+  }
+}
+
+template <typename real>
+bool crfNll(const Graph<real> &g, const real *w, long nParams,
+            const real *nodeMap, const real *edgeMap, long maxIter,
+            long nInstances, const real *Y,
+            const real *Xnode, long nNodeFeatures,
+            const EdgeFeatures<real> &Xedge, double *nll, real *grad) {
+  long nNodes = g.nNodes;
+  long nEdges = g.nEdges;
+  long maxStates = g.maxStates;
+
+  // temp structures
+  std::vector<real> nodePot(nNodes*maxStates);
+  std::vector<real> edgePot(nEdges*maxStates*maxStates);
+  std::vector<real> nodeBel(nNodes*maxStates);
+  std::vector<real> edgeBel(nEdges*maxStates*maxStates);
+
+  // compute E=nll and dE/dw
+  *nll = 0;
+  for (long i = 0; i < nInstances; i++) {
+    const real *y = Y + i*nNodes;
+    const real *xn = Xnode + i*nNodeFeatures*nNodes;
+    EdgeFeatures<real> xe = instanceFeatures(g, Xedge, i);
+
+    // make potentials
+    crfMakeNodePotentials(g, xn, nNodeFeatures, nodeMap, w, &nodePot[0]);
+    crfMakeEdgePotentials(g, xe, edgeMap, w, &edgePot[0]);
+
+    // perform inference
+    double logZ;
+    if (!inferBP(g, &nodePot[0], &edgePot[0], maxIter,
+                 &nodeBel[0], &edgeBel[0], &logZ)) return false;
+
+    // update nll
+    *nll += logZ - logPotentialForConfig(g, &nodePot[0], &edgePot[0], y);
+
+    // compute gradients
+    crfGradWrtNodes(g, xn, nNodeFeatures, nodeMap, y, &nodeBel[0], grad);
+    crfGradWrtEdges(g, xe, edgeMap, y, &edgeBel[0], nParams, grad);
+  }
+  return true;
+}
+
+// log(sum(exp(x))) over n values, and x turned into exp(x - lse)
+template <typename real>
+static inline double logSoftmax(real *x, long n) {
+  real m = x[0];
+  for (long i = 1; i < n; i++) if (x[i] > m) m = x[i];
+  double sum = 0;
+  for (long i = 0; i < n; i++) sum += exp(x[i] - m);
+  double lse = m + log(sum);
+  for (long i = 0; i < n; i++) x[i] = exp(x[i] - lse);
+  return lse;
+}
+
+// pseudo-likelihood (pseudo = true) or piecewise likelihood of all
+// instances, in parallel over instances
+template <typename real>
+static double crfLocalNll(const Graph<real> &g, const real *w, long nParams,
+                          const real *nodeMap, const real *edgeMap,
+                          long nInstances, const real *Y,
+                          const real *Xnode, long nNodeFeatures,
+                          const EdgeFeatures<real> &Xedge,
+                          real *grad, bool pseudo) {
+  long nNodes = g.nNodes;
+  long nEdges = g.nEdges;
+  long nEdgeFeatures = edgeFeatureCount(Xedge);
+  long maxStates = g.maxStates;
+  const real *nStates = g.nStates;
+  const real *edgeEnds = g.edgeEnds;
+  const real *E = g.E;
+  const real *V = g.V;
+
+  // partial gradients, one per thread
+#ifdef _OPENMP
+  long maxthreads = omp_get_max_threads();
+#else
+  long maxthreads = 1;
+#endif
+  std::vector<real> grads(maxthreads*nParams, 0);
+  double nll = 0;
+
+#pragma omp parallel reduction(+:nll)
+{
+#ifdef _OPENMP
+  long id = omp_get_thread_num();
+#else
+  long id = 0;
+#endif
+  real *partial = &grads[id*nParams];
+
+  // temp structures
+  std::vector<real> nodeTheta(nNodes*maxStates);
+  std::vector<real> edgeTheta(nEdges*maxStates*maxStates);
+  std::vector<real> q(maxStates*maxStates);
+  std::vector<real> x(nEdgeFeatures);
+
+#pragma omp for schedule(dynamic)
+  for (long i = 0; i < nInstances; i++) {
+    const real *y = Y + i*nNodes;
+    const real *xn = Xnode + i*nNodeFeatures*nNodes;
+    EdgeFeatures<real> xe = instanceFeatures(g, Xedge, i);
+
+    // log-potentials
+    for (long n = 0; n < nNodes; n++) {
+      nodeScores(g, n, xn, nNodeFeatures, nodeMap, w, &nodeTheta[n*maxStates]);
+    }
+    for (long e = 0; e < nEdges; e++) {
+      edgeFeatures(g, e, xe, &x[0]);
+      edgeScores(g, e, &x[0], nEdgeFeatures, edgeMap, w, &edgeTheta[e*maxStates*maxStates]);
+    }
+
+    // node terms: p(y_n | y_neighbors) for pseudo-likelihood, p(y_n) for
+    // the node pieces of piecewise
+    for (long n = 0; n < nNodes; n++) {
+      const real *edges = E + ((long)(V[n])-1);
+      long nEdgesOfNode = pseudo ? (long)(V[n+1]-V[n]) : 0;
+      long nS = nStates[n];
+      long label = (long)y[n]-1;
+
+      // local scores
+      for (long s = 0; s < nS; s++) q[s] = nodeTheta[n*maxStates+s];
+      for (long k = 0; k < nEdgesOfNode; k++) {
+        long e = edges[k]-1;
+        long n1 = edgeEnds[e*2+0]-1;
+        long n2 = edgeEnds[e*2+1]-1;
+        const real *theta = &edgeTheta[e*maxStates*maxStates];
+        if (n == n1) {
+          long other = (long)y[n2]-1;
+          for (long s = 0; s < nS; s++) q[s] += theta[s*maxStates+other];
+        } else {
+          long other = (long)y[n1]-1;
+          for (long s = 0; s < nS; s++) q[s] += theta[other*maxStates+s];
+        }
+      }
+      nll -= q[label];
+      nll += logSoftmax(&q[0], nS);
+
+      // gradients wrt nodes
+      for (long s = 0; s < nS; s++) {
+        real bel = q[s] - ((s == label) ? 1 : 0);
+        const real *map = nodeMap + (n*maxStates+s)*nNodeFeatures;
+        for (long f = 0; f < nNodeFeatures; f++) {
+          if (map[f] > 0) partial[(long)map[f]-1] += xn[f*nNodes+n] * bel;
+        }
+      }
+
+      // gradients wrt the edges n was conditioned through
+      for (long k = 0; k < nEdgesOfNode; k++) {
+        long e = edges[k]-1;
+        long n1 = edgeEnds[e*2+0]-1;
+        long n2 = edgeEnds[e*2+1]-1;
+        edgeFeatures(g, e, xe, &x[0]);
+        for (long s = 0; s < nS; s++) {
+          real bel = q[s] - ((s == label) ? 1 : 0);
+          long s1 = (n == n1) ? s : (long)y[n1]-1;
+          long s2 = (n == n1) ? (long)y[n2]-1 : s;
+          const real *map = edgeMap + ((e*maxStates+s1)*maxStates+s2)*nEdgeFeatures;
+          for (long f = 0; f < nEdgeFeatures; f++) {
+            if (map[f] > 0) partial[(long)map[f]-1] += x[f] * bel;
+          }
+        }
+      }
+    }
+    if (pseudo) continue;
+
+    // edge pieces: p(y_n1, y_n2), normalized over the edge alone
+    for (long e = 0; e < nEdges; e++) {
+      long n1 = edgeEnds[e*2+0]-1;
+      long n2 = edgeEnds[e*2+1]-1;
+      long nS1 = nStates[n1];
+      long nS2 = nStates[n2];
+      long label = ((long)y[n1]-1)*nS2 + (long)y[n2]-1;
+      const real *theta = &edgeTheta[e*maxStates*maxStates];
+      for (long s1 = 0; s1 < nS1; s1++) {
+        for (long s2 = 0; s2 < nS2; s2++) q[s1*nS2+s2] = theta[s1*maxStates+s2];
+      }
+      nll -= q[label];
+      nll += logSoftmax(&q[0], nS1*nS2);
+
+      // gradients wrt edges
+      edgeFeatures(g, e, xe, &x[0]);
+      for (long s1 = 0; s1 < nS1; s1++) {
+        for (long s2 = 0; s2 < nS2; s2++) {
+          real bel = q[s1*nS2+s2] - ((s1*nS2+s2 == label) ? 1 : 0);
+          const real *map = edgeMap + ((e*maxStates+s1)*maxStates+s2)*nEdgeFeatures;
+          for (long f = 0; f < nEdgeFeatures; f++) {
+            if (map[f] > 0) partial[(long)map[f]-1] += x[f] * bel;
+          }
+        }
+      }
+    }
+  }
+}
+
+  // reduce
+  for (long i = 0; i < maxthreads; i++) {
+    for (long p = 0; p < nParams; p++) grad[p] += grads[i*nParams+p];
+  }
+  return nll;
+}
+
+template <typename real>
+double crfPseudoNll(const Graph<real> &g, const real *w, long nParams,
+                    const real *nodeMap, const real *edgeMap,
+                    long nInstances, const real *Y,
+                    const real *Xnode, long nNodeFeatures,
+                    const EdgeFeatures<real> &Xedge, real *grad) {
+  return crfLocalNll(g, w, nParams, nodeMap, edgeMap, nInstances, Y,
+                     Xnode, nNodeFeatures, Xedge, grad, true);
+}
+
+template <typename real>
+double crfPiecewiseNll(const Graph<real> &g, const real *w, long nParams,
+                       const real *nodeMap, const real *edgeMap,
+                       long nInstances, const real *Y,
+                       const real *Xnode, long nNodeFeatures,
+                       const EdgeFeatures<real> &Xedge, real *grad) {
+  return crfLocalNll(g, w, nParams, nodeMap, edgeMap, nInstances, Y,
+                     Xnode, nNodeFeatures, Xedge, grad, false);
+}
+
+template <typename real>
+bool crfMarginDecode(const Graph<real> &g, const JunctionTree *jt,
+                     const real *w, const real *nodeMap, const real *edgeMap,
+                     long maxIter, long nInstances, const real *Y,
+                     const real *Xnode, long nNodeFeatures,
+                     const EdgeFeatures<real> &Xedge, real *Yhat) {
+  long nNodes = g.nNodes;
+  long nEdges = g.nEdges;
+  long maxStates = g.maxStates;
+  const real *nStates = g.nStates;
+  const real loss = exp(1.0);
+  long failed = 0;
+
+#pragma omp parallel reduction(+:failed)
+{
+  // temp structures
+  std::vector<real> nodePot(nNodes*maxStates);
+  std::vector<real> edgePot(nEdges*maxStates*maxStates);
+  std::vector<real> nodeBel(nNodes*maxStates);
+  std::vector<long> config(nNodes);
+
+#pragma omp for schedule(dynamic)
+  for (long i = 0; i < nInstances; i++) {
+    const real *y = Y + i*nNodes;
+    const real *xn = Xnode + i*nNodeFeatures*nNodes;
+    EdgeFeatures<real> xe = instanceFeatures(g, Xedge, i);
+
+    // make potentials, and add the Hamming loss to the node potentials
+    crfMakeNodePotentials(g, xn, nNodeFeatures, nodeMap, w, &nodePot[0]);
+    crfMakeEdgePotentials(g, xe, edgeMap, w, &edgePot[0]);
+    for (long n = 0; n < nNodes; n++) {
+      long label = (long)y[n]-1;
+      for (long s = 0; s < nStates[n]; s++) {
+        if (s != label) nodePot[n*maxStates+s] *= loss;
+      }
+    }
+
+    // decode
+    bool ok;
+    if (jt) ok = decodeJunctionTree(g, *jt, &nodePot[0], &edgePot[0], &config[0]);
+    else ok = decodeBP(g, &nodePot[0], &edgePot[0], maxIter, &nodeBel[0], &config[0]) > 0;
+    if (!ok) failed++;
+    for (long n = 0; n < nNodes; n++) Yhat[i*nNodes+n] = config[n];
+  }
+}
+  return failed == 0;
+}
+
+// log-potential of labeling y; its feature counts are also added to grad
+// (if not NULL), times sign. x holds F edge features.
+template <typename real>
+static double crfScore(const Graph<real> &g, const real *w,
+                       const real *nodeMap, const real *edgeMap, const real *y,
+                       const real *xn, long nNodeFeatures,
+                       const EdgeFeatures<real> &xe, real *x,
+                       real sign, real *grad) {
+  long nNodes = g.nNodes;
+  long nEdges = g.nEdges;
+  long nEdgeFeatures = edgeFeatureCount(xe);
+  long maxStates = g.maxStates;
+  const real *edgeEnds = g.edgeEnds;
+  double score = 0;
+
+  // node features at the labels
+  for (long n = 0; n < nNodes; n++) {
+    const real *map = nodeMap + (n*maxStates+(long)y[n]-1)*nNodeFeatures;
+    for (long f = 0; f < nNodeFeatures; f++) {
+      if (map[f] > 0) {
+        real x = xn[f*nNodes+n];
+        score += w[(long)map[f]-1]*x;
+        if (grad) grad[(long)map[f]-1] += sign*x;
+      }
+    }
+  }
+
+  // edge features at the labels of both ends
+  for (long e = 0; e < nEdges; e++) {
+    long s1 = (long)y[(long)edgeEnds[e*2+0]-1]-1;
+    long s2 = (long)y[(long)edgeEnds[e*2+1]-1]-1;
+    const real *map = edgeMap + ((e*maxStates+s1)*maxStates+s2)*nEdgeFeatures;
+    edgeFeatures(g, e, xe, x);
+    for (long f = 0; f < nEdgeFeatures; f++) {
+      if (map[f] > 0) {
+        score += w[(long)map[f]-1]*x[f];
+        if (grad) grad[(long)map[f]-1] += sign*x[f];
+      }
+    }
+  }
+  return score;
+}
+
+template <typename real>
+double crfMarginLoss(const Graph<real> &g, const real *w, long nParams,
+                     const real *nodeMap, const real *edgeMap,
+                     long nInstances, const real *Y, const real *Yhat,
+                     const real *Xnode, long nNodeFeatures,
+                     const EdgeFeatures<real> &Xedge, real *grad) {
+  long nNodes = g.nNodes;
+
+  // partial gradients, one per thread
+#ifdef _OPENMP
+  long maxthreads = omp_get_max_threads();
+#else
+  long maxthreads = 1;
+#endif
+  std::vector<real> grads(maxthreads*nParams, 0);
+  double total = 0;
+
+#pragma omp parallel reduction(+:total)
+{
+#ifdef _OPENMP
+  long id = omp_get_thread_num();
+#else
+  long id = 0;
+#endif
+  real *partial = &grads[id*nParams];
+  std::vector<real> x(edgeFeatureCount(Xedge));
+
+#pragma omp for schedule(dynamic)
+  for (long i = 0; i < nInstances; i++) {
+    const real *y = Y + i*nNodes;
+    const real *yhat = Yhat + i*nNodes;
+    const real *xn = Xnode + i*nNodeFeatures*nNodes;
+    EdgeFeatures<real> xe = instanceFeatures(g, Xedge, i);
+
+    // margin violation
+    double hamming = 0;
+    for (long n = 0; n < nNodes; n++) if (y[n] != yhat[n]) hamming++;
+    double margin = hamming
+      + crfScore(g, w, nodeMap, edgeMap, yhat, xn, nNodeFeatures, xe, &x[0], (real)0, (real *)NULL)
+      - crfScore(g, w, nodeMap, edgeMap, y, xn, nNodeFeatures, xe, &x[0], (real)0, (real *)NULL);
+    if (margin <= 0) continue;
+    total += margin;
+
+    // subgradient: counts of yhat - counts of y
+    crfScore(g, w, nodeMap, edgeMap, yhat, xn, nNodeFeatures, xe, &x[0], (real)1, partial);
+    crfScore(g, w, nodeMap, edgeMap, y, xn, nNodeFeatures, xe, &x[0], (real)-1, partial);
+  }
+}
+
+  // reduce
+  for (long i = 0; i < maxthreads; i++) {
+    for (long p = 0; p < nParams; p++) grad[p] += grads[i*nParams+p];
+  }
+  return total;
+}
+
+#define GM_INSTANTIATE(real) \
+  template void crfMakeNodePotentials<real>(const Graph<real> &, const real *, long, const real *, const real *, real *); \
+  template void crfMakeEdgePotentials<real>(const Graph<real> &, const EdgeFeatures<real> &, const real *, const real *, real *); \
+  template void crfGradWrtNodes<real>(const Graph<real> &, const real *, long, const real *, const real *, const real *, real *); \
+  template void crfGradWrtEdges<real>(const Graph<real> &, const EdgeFeatures<real> &, const real *, const real *, const real *, long, real *); \
+  template bool crfNll<real>(const Graph<real> &, const real *, long, const real *, const real *, long, long, const real *, const real *, long, const EdgeFeatures<real> &, double *, real *); \
+  template double crfPseudoNll<real>(const Graph<real> &, const real *, long, const real *, const real *, long, const real *, const real *, long, const EdgeFeatures<real> &, real *); \
+  template double crfPiecewiseNll<real>(const Graph<real> &, const real *, long, const real *, const real *, long, const real *, const real *, long, const EdgeFeatures<real> &, real *); \
+  template bool crfMarginDecode<real>(const Graph<real> &, const JunctionTree *, const real *, const real *, const real *, long, long, const real *, const real *, long, const EdgeFeatures<real> &, real *); \
+  template double crfMarginLoss<real>(const Graph<real> &, const real *, long, const real *, const real *, long, const real *, const real *, const real *, long, const EdgeFeatures<real> &, real *);
+
+GM_INSTANTIATE(float)
+GM_INSTANTIATE(double)
+
+}
@@ -0,0 +1,130 @@
+#ifndef GM_ENERGIES_H
+#define GM_ENERGIES_H
+
+#include "gm_graph.h"
+#include "gm_junction.h"
+
+namespace gm {
+
+// CRF energies. Buffers are contiguous, with the layouts used by
+// gm.energies.crf:
+//   Xnode:   F x N            nodeMap: N x maxStates x F
+//   Xedge:   F x E            edgeMap: E x maxStates x maxStates x F
+//   nodePot, nodeBel: N x maxStates
+//   edgePot, edgeBel: E x maxStates x maxStates
+// Maps hold 1-based indices into w (0 = not tied to any parameter), and
+// y holds 1-based labels.
+
+// Edge features are either read from a materialized Xedge, or generated
+// from the node features and the edge ends by a built-in recipe, one edge
+// at a time, right where the kernels use them (Xedge is never stored):
+//   kEdgeBias:     F = 1:       1
+//   kEdgeAbsDiff:  F = 1+Fn:    1, |Xnode[f][n1] - Xnode[f][n2]|
+//   kEdgeConcat:   F = 1+2*Fn:  1, Xnode[f][n1], Xnode[f][n2]
+// with Fn node features, and n1, n2 the ends of the edge (concatenation
+// follows the edge orientation).
+enum { kEdgeBias = 1, kEdgeAbsDiff = 2, kEdgeConcat = 3 };
+
+template <typename real>
+struct EdgeFeatures {
+  int recipe;     // 0 for a materialized Xedge
+  const real *X;  // Xedge (F x E), or Xnode (Fn x N) with a recipe; with
+                  // a leading nInstances dimension for batches
+  long nX;        // F, or Fn with a recipe
+};
+
+// Nb of edge features F.
+template <typename real>
+inline long edgeFeatureCount(const EdgeFeatures<real> &Xedge) {
+  switch (Xedge.recipe) {
+    case kEdgeBias: return 1;
+    case kEdgeAbsDiff: return 1 + Xedge.nX;
+    case kEdgeConcat: return 1 + 2*Xedge.nX;
+    default: return Xedge.nX;
+  }
+}
+
+// nodePot = exp(sum_f w[nodeMap] * Xnode).
+template <typename real>
+void crfMakeNodePotentials(const Graph<real> &g, const real *Xnode,
+                           long nNodeFeatures, const real *nodeMap,
+                           const real *w, real *nodePot);
+
+// edgePot = exp(sum_f w[edgeMap] * Xedge).
+template <typename real>
+void crfMakeEdgePotentials(const Graph<real> &g,
+                           const EdgeFeatures<real> &Xedge,
+                           const real *edgeMap, const real *w, real *edgePot);
+
+// Accumulates the node part of d(nll)/dw into grad.
+template <typename real>
+void crfGradWrtNodes(const Graph<real> &g, const real *Xnode,
+                     long nNodeFeatures, const real *nodeMap, const real *y,
+                     const real *nodeBel, real *grad);
+
+// Accumulates the edge part of d(nll)/dw into grad (nParams entries).
+template <typename real>
+void crfGradWrtEdges(const Graph<real> &g, const EdgeFeatures<real> &Xedge,
+                     const real *edgeMap, const real *y, const real *edgeBel,
+                     long nParams, real *grad);
+
+// Negative log-likelihood of nInstances labelings Y (nInstances x N) given
+// features Xnode (nInstances x F x N) and Xedge (nInstances x F x E), using
+// belief propagation, as gm.energies.crf.nll with 'bp'. Accumulates the
+// gradient into grad and returns false on underflow.
+template <typename real>
+bool crfNll(const Graph<real> &g, const real *w, long nParams,
+            const real *nodeMap, const real *edgeMap, long maxIter,
+            long nInstances, const real *Y,
+            const real *Xnode, long nNodeFeatures,
+            const EdgeFeatures<real> &Xedge, double *nll, real *grad);
+
+// Negative pseudo-likelihood of nInstances labelings (same layouts as
+// crfNll): each node is conditioned on its neighbours' true labels, so
+// only local normalizations are needed. Instances are processed in
+// parallel; accumulates the gradient into grad.
+template <typename real>
+double crfPseudoNll(const Graph<real> &g, const real *w, long nParams,
+                    const real *nodeMap, const real *edgeMap,
+                    long nInstances, const real *Y,
+                    const real *Xnode, long nNodeFeatures,
+                    const EdgeFeatures<real> &Xedge, real *grad);
+
+// Negative piecewise likelihood: every node and edge potential is
+// normalized on its own, as an independent piece.
+template <typename real>
+double crfPiecewiseNll(const Graph<real> &g, const real *w, long nParams,
+                       const real *nodeMap, const real *edgeMap,
+                       long nInstances, const real *Y,
+                       const real *Xnode, long nNodeFeatures,
+                       const EdgeFeatures<real> &Xedge, real *grad);
+
+// Loss-augmented decoding for max-margin training: for each instance,
+// the labeling that maximizes score(y') + hamming(y, y'), with score the
+// log-potential. The Hamming loss enters as a factor e on every node
+// potential but the true label's, and decoding is max-product BP, or
+// exact on the junction tree jt when given. Instances are decoded in
+// parallel; fills Yhat (nInstances x N) and returns false if any of them
+// underflows.
+template <typename real>
+bool crfMarginDecode(const Graph<real> &g, const JunctionTree *jt,
+                     const real *w, const real *nodeMap, const real *edgeMap,
+                     long maxIter, long nInstances, const real *Y,
+                     const real *Xnode, long nNodeFeatures,
+                     const EdgeFeatures<real> &Xedge, real *Yhat);
+
+// Structured hinge loss of nInstances labelings Y, given loss-augmented
+// labelings Yhat (from any decoder): sum of score(yhat) + hamming(y, yhat)
+// - score(y). Accumulates the subgradient (feature counts of yhat minus
+// those of y) into grad, in parallel over instances. Instances where yhat
+// doesn't beat y (approximate decoding) count as zero.
+template <typename real>
+double crfMarginLoss(const Graph<real> &g, const real *w, long nParams,
+                     const real *nodeMap, const real *edgeMap,
+                     long nInstances, const real *Y, const real *Yhat,
+                     const real *Xnode, long nNodeFeatures,
+                     const EdgeFeatures<real> &Xedge, real *grad);
+
+}
+
+#endif
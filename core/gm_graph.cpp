@@ -0,0 +1,310 @@
+#include "gm_graph.h"
+
+#include <math.h>
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+
+namespace gm {
+
+template <typename real>
+Graph<real> GraphStorage<real>::graph() const {
+  Graph<real> g;
+  g.nNodes = nNodes;
+  g.nEdges = nEdges;
+  g.maxStates = maxStates;
+  g.nStates = nStates.empty() ? 0 : &nStates[0];
+  g.edgeEnds = edgeEnds.empty() ? 0 : &edgeEnds[0];
+  g.V = V.empty() ? 0 : &V[0];
+  g.E = E.empty() ? 0 : &E[0];
+  return g;
+}
+
+template <typename real>
+void makeGraph(long nNodes, long nEdges, const long *edges,
+               const long *nStates, GraphStorage<real> &storage) {
+  storage.nNodes = nNodes;
+  storage.nEdges = nEdges;
+  storage.maxStates = 0;
+  storage.nStates.assign(nNodes, 0);
+  storage.edgeEnds.assign(nEdges*2, 0);
+  storage.V.assign(nNodes+1, 0);
+  storage.E.assign(nEdges*2, 0);
+
+  // states
+  for (long n = 0; n < nNodes; n++) {
+    storage.nStates[n] = nStates[n];
+    if (nStates[n] > storage.maxStates) storage.maxStates = nStates[n];
+  }
+
+  // count incident edges for each node
+  std::vector<long> nNei(nNodes+1, 0);
+  for (long e = 0; e < nEdges; e++) {
+    storage.edgeEnds[e*2+0] = edges[e*2+0];
+    storage.edgeEnds[e*2+1] = edges[e*2+1];
+    nNei[edges[e*2+0]]++;
+    nNei[edges[e*2+1]]++;
+  }
+
+  // V[n] = 1 + nb of edges connected to nodes (1,...,n-1)
+  long edge = 1;
+  for (long n = 0; n < nNodes; n++) {
+    storage.V[n] = edge;
+    edge += nNei[n+1];
+  }
+  storage.V[nNodes] = edge;
+
+  // E = edges of each node, in increasing order
+  std::vector<long> fill(nNodes, 0);
+  for (long e = 0; e < nEdges; e++) {
+    for (long k = 0; k < 2; k++) {
+      long n = edges[e*2+k]-1;
+      storage.E[(long)storage.V[n]-1 + fill[n]++] = e+1;
+    }
+  }
+}
+
+// breadth-first search from root over unvisited nodes; appends them to
+// order, and returns the nb of levels (last is set to the index in order
+// where the last level starts)
+static long breadthFirst(const std::vector<std::vector<long> > &nei,
+                         long root, std::vector<char> &visited,
+                         std::vector<long> &order, long *last) {
+  long levels = 1;
+  long end = order.size()+1;
+  *last = order.size();
+  order.push_back(root);
+  visited[root] = 1;
+  for (long head = *last; head < (long)order.size(); head++) {
+    if (head == end) {
+      levels++;
+      *last = head;
+      end = order.size();
+    }
+    const std::vector<long> &adj = nei[order[head]];
+    for (size_t k = 0; k < adj.size(); k++) {
+      if (!visited[adj[k]]) {
+        visited[adj[k]] = 1;
+        order.push_back(adj[k]);
+      }
+    }
+  }
+  return levels;
+}
+
+template <typename real>
+void orderGraph(const Graph<real> &g, int ordering, long *nodeOrder,
+                long *edgeOrder, GraphStorage<real> &storage) {
+  long nNodes = g.nNodes;
+  long nEdges = g.nEdges;
+
+  // neighbours of each node (by increasing degree, for Cuthill-McKee)
+  std::vector<std::vector<long> > nei(nNodes);
+  for (long e = 0; e < nEdges; e++) {
+    long n1 = g.edgeEnds[e*2+0]-1;
+    long n2 = g.edgeEnds[e*2+1]-1;
+    nei[n1].push_back(n2);
+    nei[n2].push_back(n1);
+  }
+  std::vector<std::pair<long,long> > byDegree;
+  for (long n = 0; n < nNodes; n++) {
+    byDegree.clear();
+    for (size_t k = 0; k < nei[n].size(); k++) {
+      long m = nei[n][k];
+      byDegree.push_back(std::make_pair(ordering == kOrderRCM ? (long)nei[m].size() : 0, m));
+    }
+    std::sort(byDegree.begin(), byDegree.end());
+    for (size_t k = 0; k < byDegree.size(); k++) nei[n][k] = byDegree[k].second;
+  }
+
+  // nodes by increasing degree, to seed each connected component
+  std::vector<std::pair<long,long> > seeds(nNodes);
+  for (long n = 0; n < nNodes; n++) seeds[n] = std::make_pair((long)nei[n].size(), n);
+  std::sort(seeds.begin(), seeds.end());
+
+  // one search per component, from a pseudo-peripheral node: starting at
+  // its lowest degree node, move to the lowest degree node of the last
+  // level for as long as that makes the search deeper
+  std::vector<long> order;
+  std::vector<long> trial;
+  std::vector<char> visited(nNodes, 0);
+  for (long i = 0; i < nNodes; i++) {
+    long root = seeds[i].second;
+    if (visited[root]) continue;
+    long depth = 0;
+    for (;;) {
+      long last;
+      trial.clear();
+      long levels = breadthFirst(nei, root, visited, trial, &last);
+      for (size_t k = 0; k < trial.size(); k++) visited[trial[k]] = 0;
+      if (levels <= depth) break;
+      depth = levels;
+      long next = trial[last];
+      for (size_t k = last; k < trial.size(); k++) {
+        if (nei[trial[k]].size() < nei[next].size()) next = trial[k];
+      }
+      if (next == root) break;
+      root = next;
+    }
+    long last;
+    breadthFirst(nei, root, visited, order, &last);
+  }
+  if (ordering == kOrderRCM) std::reverse(order.begin(), order.end());
+
+  // new node numbers
+  std::vector<long> rank(nNodes);
+  for (long i = 0; i < nNodes; i++) {
+    nodeOrder[i] = order[i]+1;
+    rank[order[i]] = i;
+  }
+
+  // edges by (lowest, highest) new end
+  std::vector<std::pair<std::pair<long,long>,long> > edges(nEdges);
+  for (long e = 0; e < nEdges; e++) {
+    long r1 = rank[(long)g.edgeEnds[e*2+0]-1];
+    long r2 = rank[(long)g.edgeEnds[e*2+1]-1];
+    edges[e] = std::make_pair(std::make_pair(std::min(r1,r2), std::max(r1,r2)), e);
+  }
+  std::sort(edges.begin(), edges.end());
+
+  // renumbered topology
+  std::vector<long> ends(nEdges*2);
+  std::vector<long> states(nNodes);
+  for (long i = 0; i < nEdges; i++) {
+    long e = edges[i].second;
+    edgeOrder[i] = e+1;
+    ends[i*2+0] = rank[(long)g.edgeEnds[e*2+0]-1]+1;
+    ends[i*2+1] = rank[(long)g.edgeEnds[e*2+1]-1]+1;
+  }
+  for (long i = 0; i < nNodes; i++) states[i] = g.nStates[order[i]];
+  makeGraph(nNodes, nEdges, ends.empty() ? NULL : &ends[0],
+            states.empty() ? NULL : &states[0], storage);
+}
+
+template <typename real>
+void maxProduct(const real *matrix, long rows, long cols,
+                const real *vector, real *result) {
+  for (long i = 0; i < rows; i++) {
+    result[i] = 0;
+    for (long j = 0; j < cols; j++) {
+      real product = matrix[i*cols + j] * vector[j];
+      if (product > result[i]) {
+        result[i] = product;
+      }
+    }
+  }
+}
+
+template <typename real>
+real potentialForConfig(const Graph<real> &g, const real *nodePot,
+                        const real *edgePot, const real *y) {
+  long maxStates = g.maxStates;
+  real pot = 1;
+
+  // node potentials
+  for (long n = 0; n < g.nNodes; n++) {
+    pot *= nodePot[n*maxStates+(long)(y[n]-1)];
+  }
+
+  // edge potentials
+  for (long e = 0; e < g.nEdges; e++) {
+    long n1 = g.edgeEnds[e*2+0]-1;
+    long n2 = g.edgeEnds[e*2+1]-1;
+    pot *= edgePot[(e*maxStates+(long)(y[n1]-1))*maxStates+(long)(y[n2]-1)];
+  }
+  return pot;
+}
+
+template <typename real>
+double logPotentialForConfig(const Graph<real> &g, const real *nodePot,
+                             const real *edgePot, const real *y) {
+  long maxStates = g.maxStates;
+  double logpot = 0;
+
+  // node potentials
+  for (long n = 0; n < g.nNodes; n++) {
+    logpot += log(nodePot[n*maxStates+(long)(y[n]-1)]);
+  }
+
+  // edge potentials
+  for (long e = 0; e < g.nEdges; e++) {
+    long n1 = g.edgeEnds[e*2+0]-1;
+    long n2 = g.edgeEnds[e*2+1]-1;
+    logpot += log(edgePot[(e*maxStates+(long)(y[n1]-1))*maxStates+(long)(y[n2]-1)]);
+  }
+  return logpot;
+}
+
+template <typename real>
+void logPotentialsForConfigs(const Graph<real> &g, const real *nodePot,
+                             const real *edgePot, long nConfigs,
+                             const real *Y, real *logPot, real *nodeTerms,
+                             real *edgeTerms) {
+  long nNodes = g.nNodes;
+  long nEdges = g.nEdges;
+  long maxStates = g.maxStates;
+  long tableSize = maxStates*maxStates;
+  const real *edgeEnds = g.edgeEnds;
+
+  // log tables, shared by all configurations (edge tables only pay off
+  // with more configurations than entries per table)
+  std::vector<real> logNode(nNodes*maxStates);
+  for (long i = 0; i < nNodes*maxStates; i++) logNode[i] = log(nodePot[i]);
+  bool edgeTables = nConfigs >= tableSize;
+  std::vector<real> logEdge(edgeTables ? nEdges*tableSize : 0);
+  for (long i = 0; i < (long)logEdge.size(); i++) logEdge[i] = log(edgePot[i]);
+
+  // edge ends, as integer offsets
+  std::vector<long> end1(nEdges), end2(nEdges);
+  for (long e = 0; e < nEdges; e++) {
+    end1[e] = (long)edgeEnds[e*2+0]-1;
+    end2[e] = (long)edgeEnds[e*2+1]-1;
+  }
+
+#pragma omp parallel
+{
+  std::vector<real> terms(nNodes > nEdges ? nNodes : nEdges);
+
+#pragma omp for
+  for (long k = 0; k < nConfigs; k++) {
+    const real *y = Y + k*nNodes;
+    real *nt = nodeTerms ? nodeTerms + k*nNodes : &terms[0];
+    real *et = edgeTerms ? edgeTerms + k*nEdges : &terms[0];
+    double sum = 0;
+
+    // node terms: one gather per node
+    for (long n = 0; n < nNodes; n++) {
+      nt[n] = logNode[n*maxStates+(long)y[n]-1];
+    }
+    for (long n = 0; n < nNodes; n++) sum += nt[n];
+
+    // edge terms: one gather per edge
+    if (edgeTables) {
+      for (long e = 0; e < nEdges; e++) {
+        et[e] = logEdge[e*tableSize+((long)y[end1[e]]-1)*maxStates+(long)y[end2[e]]-1];
+      }
+    } else {
+      for (long e = 0; e < nEdges; e++) {
+        et[e] = log(edgePot[e*tableSize+((long)y[end1[e]]-1)*maxStates+(long)y[end2[e]]-1]);
+      }
+    }
+    for (long e = 0; e < nEdges; e++) sum += et[e];
+    logPot[k] = sum;
+  }
+}
+}
+
+#define GM_INSTANTIATE(real) \
+  template struct GraphStorage<real>; \
+  template void makeGraph<real>(long, long, const long *, const long *, GraphStorage<real> &); \
+  template void orderGraph<real>(const Graph<real> &, int, long *, long *, GraphStorage<real> &); \
+  template void maxProduct<real>(const real *, long, long, const real *, real *); \
+  template real potentialForConfig<real>(const Graph<real> &, const real *, const real *, const real *); \
+  template double logPotentialForConfig<real>(const Graph<real> &, const real *, const real *, const real *); \
+  template void logPotentialsForConfigs<real>(const Graph<real> &, const real *, const real *, long, const real *, real *, real *, real *);
+
+GM_INSTANTIATE(float)
+GM_INSTANTIATE(double)
+
+}
@@ -0,0 +1,85 @@
+#ifndef GM_GRAPH_H
+#define GM_GRAPH_H
+
+#include <vector>
+
+namespace gm {
+
+// Graph topology, laid out exactly as gm.graph() builds it: indices and
+// labels are 1-based and stored as reals, so that the Torch tensors of a
+// Lua graph can be handed to the kernels without any conversion.
+template <typename real>
+struct Graph {
+  long nNodes;
+  long nEdges;
+  long maxStates;
+  const real *nStates;   // N: nb of states of each node
+  const real *edgeEnds;  // E x 2: end nodes of each edge
+  const real *V;         // N+1: V[n] is the offset of node n's edges in E
+  const real *E;         // 2E: edges incident to each node, sorted
+};
+
+// Owns the arrays a Graph points to, for callers that don't come from Lua.
+template <typename real>
+struct GraphStorage {
+  long nNodes;
+  long nEdges;
+  long maxStates;
+  std::vector<real> nStates;
+  std::vector<real> edgeEnds;
+  std::vector<real> V;
+  std::vector<real> E;
+
+  Graph<real> graph() const;
+};
+
+// Builds a topology from nEdges (n1,n2) pairs, with 1-based n1 < n2.
+template <typename real>
+void makeGraph(long nNodes, long nEdges, const long *edges,
+               const long *nStates, GraphStorage<real> &storage);
+
+// Locality-improving renumberings, for the message passing kernels, which
+// sweep nodes in index order and touch the nodePot, edgePot and msg rows
+// of each node's edges: breadth-first, or reverse Cuthill-McKee, from a
+// pseudo-peripheral node of each connected component.
+enum { kOrderBFS = 1, kOrderRCM = 2 };
+
+// Renumbers the nodes of g with the given ordering, and its edges by their
+// lowest, then highest, new end node. nodeOrder[i] (N) and edgeOrder[i]
+// (E) are the 1-based original node and edge behind the new node/edge i,
+// and storage gets the renumbered topology. Edges keep their orientation
+// (n1 may then be larger than n2), so edge tables and messages only move
+// by rows.
+template <typename real>
+void orderGraph(const Graph<real> &g, int ordering, long *nodeOrder,
+                long *edgeOrder, GraphStorage<real> &storage);
+
+// result[i] = max_j matrix[i][j] * vector[j], for a rows x cols matrix.
+template <typename real>
+void maxProduct(const real *matrix, long rows, long cols,
+                const real *vector, real *result);
+
+// Unnormalized potential of configuration y (N, 1-based labels).
+// nodePot is N x maxStates, edgePot is E x maxStates x maxStates.
+template <typename real>
+real potentialForConfig(const Graph<real> &g, const real *nodePot,
+                        const real *edgePot, const real *y);
+
+// Same as potentialForConfig, but in the log domain.
+template <typename real>
+double logPotentialForConfig(const Graph<real> &g, const real *nodePot,
+                             const real *edgePot, const real *y);
+
+// Log-potentials of nConfigs configurations Y (nConfigs x N), in parallel
+// over configurations. If nodeTerms (nConfigs x N) and edgeTerms
+// (nConfigs x E) aren't NULL, they get the log-potential of each node and
+// edge, in the same pass.
+template <typename real>
+void logPotentialsForConfigs(const Graph<real> &g, const real *nodePot,
+                             const real *edgePot, long nConfigs,
+                             const real *Y, real *logPot, real *nodeTerms,
+                             real *edgeTerms);
+
+}
+
+#endif
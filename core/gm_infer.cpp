@@ -0,0 +1,910 @@
+#include "gm_infer.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <vector>
+
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+namespace gm {
+
+// Storage policies of the message passing loops: potentials are read one
+// edge table at a time and messages one entry at a time, so that compact
+// storage (gm_compact.h) is decoded on the fly, and arithmetic stays in real.
+template <typename real>
+struct DensePotentials {
+  const real *pot;
+  long maxStates;
+  const real *table(long e, long /* nS1 */, long /* nS2 */, real * /* buffer */) const {
+    return pot + e*maxStates*maxStates;
+  }
+};
+
+template <typename real>
+struct PackedPotentials {
+  const CompactPotentials &pot;
+  const real *table(long e, long nS1, long nS2, real *buffer) const {
+    expandPotentials(pot, e, nS1, nS2, buffer);
+    return buffer;
+  }
+};
+
+static inline float loadMessage(float m) { return m; }
+static inline double loadMessage(double m) { return m; }
+static inline float loadMessage(uint16_t m) { return halfToFloat(m); }
+
+static inline void storeMessage(float *m, double x) { *m = x; }
+static inline void storeMessage(double *m, double x) { *m = x; }
+static inline void storeMessage(uint16_t *m, double x) {
+  // keep nonzero entries nonzero: beliefs divide by messages
+  uint16_t h = floatToHalf(x);
+  if (h == 0 && x > 0) h = 1;
+  *m = h;
+}
+
+template <typename real, typename msg_t>
+static void initMessages(const Graph<real> &g, msg_t *msg) {
+  long nEdges = g.nEdges;
+  long maxStates = g.maxStates;
+  const real *edgeEnds = g.edgeEnds;
+  const real *nStates = g.nStates;
+
+  // propagate state normalizations
+#pragma omp parallel for
+  for (long e = 0; e < nEdges; e++) {
+    // get edge of interest, and its nodes
+    long n1 = edgeEnds[e*2+0]-1;
+    long n2 = edgeEnds[e*2+1]-1;
+
+    // propagate
+    for (long s = 0; s < nStates[n2]; s++) {
+      storeMessage(&msg[e*maxStates+s], 1/nStates[n2]); //  n1 ==> n2
+    }
+    for (long s = 0; s < nStates[n1]; s++) {
+      storeMessage(&msg[(e+nEdges)*maxStates+s], 1/nStates[n1]); //  n2 ==> n1
+    }
+  }
+}
+
+// product of node n's potential and of its incoming messages, except the
+// one coming through edge e
+template <typename real, typename msg_t>
+static inline void cavity(const Graph<real> &g, long n, long e,
+                          const real *nodePot, const msg_t *msg, real *prod) {
+  long nEdges = g.nEdges;
+  long maxStates = g.maxStates;
+  const real *edges = g.E + ((long)(g.V[n])-1);
+  long nEdgesOfNode = (long)(g.V[n+1]-g.V[n]);
+  long nS = g.nStates[n];
+
+  for (long s = 0; s < nS; s++) prod[s] = nodePot[n*maxStates+s];
+  for (long k = 0; k < nEdgesOfNode; k++) {
+    long ee = edges[k]-1;
+    long nn1 = g.edgeEnds[ee*2+0]-1;
+    if (ee != e) {
+      const msg_t *messg = msg + ((n == nn1) ? ee+nEdges : ee)*maxStates;
+      for (long s = 0; s < nS; s++) prod[s] *= loadMessage(messg[s]);
+    }
+  }
+}
+
+// new message from node n to the other end of e, through the joint
+// potential pot_ij (nStates[n1] x nStates[n2], row stride maxStates),
+// given n's cavity product prod; returns false if it is all zeros
+template <typename real, typename msg_t>
+static inline bool sendMessage(const Graph<real> &g, long n, long e,
+                               const real *pot_ij, const real *prod,
+                               bool maxprod, real *out, msg_t *msg) {
+  long nEdges = g.nEdges;
+  long maxStates = g.maxStates;
+  long n1 = g.edgeEnds[e*2+0]-1;
+  long n2 = g.edgeEnds[e*2+1]-1;
+  long nS = g.nStates[n];
+  msg_t *messg;
+  long nOut, si, sj;
+  if (n == n1) {
+    messg = msg + e*maxStates;
+    nOut = g.nStates[n2]; si = 1; sj = maxStates;
+  } else {
+    messg = msg + (e+nEdges)*maxStates;
+    nOut = g.nStates[n1]; si = maxStates; sj = 1;
+  }
+
+  // either do a max or products, or a sum of products
+  double sum = 0;
+  for (long i = 0; i < nOut; i++) {
+    real result = 0;
+    if (maxprod) {
+      for (long j = 0; j < nS; j++) {
+        real product = pot_ij[i*si+j*sj] * prod[j];
+        if (product > result) result = product;
+      }
+    } else {
+      for (long j = 0; j < nS; j++) result += pot_ij[i*si+j*sj] * prod[j];
+    }
+    out[i] = result;
+    sum += result;
+  }
+
+  // normalize message
+  if (sum == 0) return false;
+  for (long i = 0; i < nOut; i++) storeMessage(&messg[i], out[i] / sum);
+  return true;
+}
+
+template <typename real, typename Pot, typename msg_t>
+static bool computeMessages(const Graph<real> &g, const real *nodePot,
+                            const Pot &edgePot, msg_t *msg, bool maxprod) {
+  long nNodes = g.nNodes;
+  long maxStates = g.maxStates;
+  const real *nStates = g.nStates;
+  const real *edgeEnds = g.edgeEnds;
+  const real *E = g.E;
+  const real *V = g.V;
+
+  // temp structures
+  std::vector<real> prod(maxStates);
+  std::vector<real> out(maxStates);
+  std::vector<real> table(maxStates*maxStates);
+
+  // belief propagation = message passing
+  for (long n = 0; n < nNodes; n++) {
+    // find neighbors of node n (Lua: local edges = graph:getEdgesOf(n)
+    const real *edges = E + ((long)(V[n])-1);
+    long nEdgesOfNode = (long)(V[n+1]-V[n]);
+
+    // send a message to each neighbor of node n
+    for (long k = 0; k < nEdgesOfNode; k++) {
+      long e = edges[k]-1;
+      long n1 = edgeEnds[e*2+0]-1;
+      long n2 = edgeEnds[e*2+1]-1;
+      cavity(g, n, e, nodePot, msg, &prod[0]);
+      const real *pot_ij = edgePot.table(e, nStates[n1], nStates[n2], &table[0]);
+      if (!sendMessage(g, n, e, pot_ij, &prod[0], maxprod, &out[0], msg)) return false;
+    }
+  }
+  return true;
+}
+
+// Same, in edge order: each table is decoded once per sweep, and sends
+// both of its messages. Used for compact storage, where decoding a table
+// costs more than the messages it carries.
+template <typename real, typename Pot, typename msg_t>
+static bool computeMessagesByEdge(const Graph<real> &g, const real *nodePot,
+                                  const Pot &edgePot, msg_t *msg, bool maxprod) {
+  long nEdges = g.nEdges;
+  long maxStates = g.maxStates;
+  const real *nStates = g.nStates;
+  const real *edgeEnds = g.edgeEnds;
+
+  // temp structures
+  std::vector<real> prod(maxStates);
+  std::vector<real> out(maxStates);
+  std::vector<real> table(maxStates*maxStates);
+
+  for (long e = 0; e < nEdges; e++) {
+    long n1 = edgeEnds[e*2+0]-1;
+    long n2 = edgeEnds[e*2+1]-1;
+    const real *pot_ij = edgePot.table(e, nStates[n1], nStates[n2], &table[0]);
+    cavity(g, n1, e, nodePot, msg, &prod[0]);
+    if (!sendMessage(g, n1, e, pot_ij, &prod[0], maxprod, &out[0], msg)) return false;
+    cavity(g, n2, e, nodePot, msg, &prod[0]);
+    if (!sendMessage(g, n2, e, pot_ij, &prod[0], maxprod, &out[0], msg)) return false;
+  }
+  return true;
+}
+
+// one sweep: node order on dense tables, edge order on compact ones
+template <typename real, typename msg_t>
+static inline bool sweep(const Graph<real> &g, const real *nodePot,
+                         const DensePotentials<real> &edgePot, msg_t *msg,
+                         bool maxprod) {
+  return computeMessages(g, nodePot, edgePot, msg, maxprod);
+}
+
+template <typename real, typename msg_t>
+static inline bool sweep(const Graph<real> &g, const real *nodePot,
+                         const PackedPotentials<real> &edgePot, msg_t *msg,
+                         bool maxprod) {
+  return computeMessagesByEdge(g, nodePot, edgePot, msg, maxprod);
+}
+
+template <typename real, typename msg_t>
+static bool computeNodeBeliefs(const Graph<real> &g, const real *nodePot,
+                               const msg_t *msg, real *nodeBel) {
+  long nNodes = g.nNodes;
+  long nEdges = g.nEdges;
+  long maxStates = g.maxStates;
+  const real *nStates = g.nStates;
+  const real *edgeEnds = g.edgeEnds;
+  const real *E = g.E;
+  const real *V = g.V;
+
+  // compute node beliefs
+  for (long n = 0; n < nNodes; n++) {
+    // find neighbors of node n (Lua: local edges = graph:getEdgesOf(n)
+    const real *edges = E + ((long)(V[n])-1);
+    long nEdgesOfNode = (long)(V[n+1]-V[n]);
+    long nS = nStates[n];
+
+    // get potentials
+    real *prod = nodeBel + n*maxStates;
+    for (long s = 0; s < nS; s++) prod[s] = nodePot[n*maxStates+s];
+
+    // multiply all incoming messages
+    for (long k = 0; k < nEdgesOfNode; k++) {
+      // get edge of interest, and its nodes
+      long e = edges[k]-1;
+      long n1 = edgeEnds[e*2+0]-1;
+
+      // compute component-wise product
+      const msg_t *messg = msg + ((n == n1) ? e+nEdges : e)*maxStates;
+      for (long s = 0; s < nS; s++) prod[s] *= loadMessage(messg[s]);
+    }
+
+    // normalize
+    double sum = 0;
+    for (long s = 0; s < nS; s++) sum += prod[s];
+    if (sum == 0) return false;
+    for (long s = 0; s < nS; s++) prod[s] /= sum;
+  }
+  return true;
+}
+
+template <typename real, typename Pot, typename msg_t>
+static bool computeBeliefs(const Graph<real> &g, const real *nodePot,
+                           const Pot &edgePot, const msg_t *msg,
+                           real *nodeBel, real *edgeBel, double *logZ) {
+  long nNodes = g.nNodes;
+  long nEdges = g.nEdges;
+  long maxStates = g.maxStates;
+  const real *nStates = g.nStates;
+  const real *edgeEnds = g.edgeEnds;
+  const real *E = g.E;
+  const real *V = g.V;
+  const real eps = 1e-15;
+
+  // energies and entropies, reduced over nodes and edges
+  double eng1 = 0;
+  double eng2 = 0;
+  double ent1 = 0;
+  double ent2 = 0;
+  int underflow = 0;
+
+#pragma omp parallel reduction(+:eng1,eng2,ent1,ent2) reduction(|:underflow)
+{
+  std::vector<real> table(maxStates*maxStates);
+
+  // node beliefs, node entropy and energy
+#pragma omp for
+  for (long n = 0; n < nNodes; n++) {
+    const real *edges = E + ((long)(V[n])-1);
+    long nEdgesOfNode = (long)(V[n+1]-V[n]);
+    long nS = nStates[n];
+    const real *pot = nodePot + n*maxStates;
+    real *bel = nodeBel + n*maxStates;
+
+    // product of potential and incoming messages
+    for (long s = 0; s < nS; s++) bel[s] = pot[s];
+    for (long k = 0; k < nEdgesOfNode; k++) {
+      long e = edges[k]-1;
+      long n1 = edgeEnds[e*2+0]-1;
+      const msg_t *messg = msg + ((n == n1) ? e+nEdges : e)*maxStates;
+      for (long s = 0; s < nS; s++) bel[s] *= loadMessage(messg[s]);
+    }
+
+    // normalize
+    double sum = 0;
+    for (long s = 0; s < nS; s++) sum += bel[s];
+    if (sum == 0) {
+      underflow = 1;
+      continue;
+    }
+    double ent = 0, eng = 0;
+    for (long s = 0; s < nS; s++) {
+      bel[s] /= sum;
+      real b = bel[s] + eps;
+      ent += b * log(b);
+      eng += b * log(pot[s]);
+    }
+    ent1 += (nEdgesOfNode-1) * ent;
+    eng1 -= eng;
+  }
+
+  // edge beliefs (once all node beliefs are known), edge entropy and
+  // energy
+#pragma omp for
+  for (long e = 0; e < nEdges; e++) {
+    long n1 = edgeEnds[e*2+0]-1;
+    long n2 = edgeEnds[e*2+1]-1;
+    long nS1 = nStates[n1];
+    long nS2 = nStates[n2];
+    const real *bel1 = nodeBel + n1*maxStates;
+    const real *bel2 = nodeBel + n2*maxStates;
+    const msg_t *msg21 = msg + (e+nEdges)*maxStates;
+    const msg_t *msg12 = msg + e*maxStates;
+    const real *pot = edgePot.table(e, nS1, nS2, &table[0]);
+    real *bel = edgeBel + e*maxStates*maxStates;
+
+    // outer product of node beliefs, without the message coming from
+    // the other node, times the joint potential
+    double sum = 0;
+    for (long i = 0; i < nS1; i++) {
+      real b1 = bel1[i] / loadMessage(msg21[i]);
+      for (long j = 0; j < nS2; j++) {
+        bel[i*maxStates+j] = b1 * (bel2[j] / loadMessage(msg12[j])) * pot[i*maxStates+j];
+        sum += bel[i*maxStates+j];
+      }
+    }
+
+    // normalize
+    if (sum == 0) {
+      underflow = 1;
+      continue;
+    }
+    double ent = 0, eng = 0;
+    for (long i = 0; i < nS1; i++) {
+      for (long j = 0; j < nS2; j++) {
+        bel[i*maxStates+j] /= sum;
+        real b = bel[i*maxStates+j] + eps;
+        ent += b * log(b);
+        eng += b * log(pot[i*maxStates+j]);
+      }
+    }
+    ent2 -= ent;
+    eng2 -= eng;
+  }
+}
+
+  // free energy
+  double F = (eng1+eng2) - (ent1+ent2);
+  *logZ = -F;
+  return !underflow;
+}
+
+template <typename real>
+void bpInitMessages(const Graph<real> &g, real *msg) {
+  initMessages(g, msg);
+}
+
+template <typename real>
+bool bpComputeMessages(const Graph<real> &g, const real *nodePot,
+                       const real *edgePot, real *msg, bool maxprod) {
+  DensePotentials<real> pot = {edgePot, g.maxStates};
+  return computeMessages(g, nodePot, pot, msg, maxprod);
+}
+
+template <typename real>
+bool bpComputeNodeBeliefs(const Graph<real> &g, const real *nodePot,
+                          const real *msg, real *nodeBel) {
+  return computeNodeBeliefs(g, nodePot, msg, nodeBel);
+}
+
+template <typename real>
+bool bpComputeEdgeBeliefs(const Graph<real> &g, const real *edgePot,
+                          const real *nodeBel, const real *msg, real *edgeBel) {
+  long nEdges = g.nEdges;
+  long maxStates = g.maxStates;
+  const real *nStates = g.nStates;
+  const real *edgeEnds = g.edgeEnds;
+
+  // temp structures
+  std::vector<real> belN1(maxStates);
+  std::vector<real> belN2(maxStates);
+
+  // compute edge beliefs
+  for (long e = 0; e < nEdges; e++) {
+    // get edge of interest, and its nodes
+    long n1 = edgeEnds[e*2+0]-1;
+    long n2 = edgeEnds[e*2+1]-1;
+    long nS1 = nStates[n1];
+    long nS2 = nStates[n2];
+
+    // beliefs of each node, without the message coming from the other
+    for (long s = 0; s < nS1; s++) {
+      belN1[s] = nodeBel[n1*maxStates+s] / msg[(e+nEdges)*maxStates+s];
+    }
+    for (long s = 0; s < nS2; s++) {
+      belN2[s] = nodeBel[n2*maxStates+s] / msg[e*maxStates+s];
+    }
+
+    // compute edge beliefs
+    const real *pot = edgePot + e*maxStates*maxStates;
+    real *bel = edgeBel + e*maxStates*maxStates;
+    double sum = 0;
+    for (long i = 0; i < nS1; i++) {
+      for (long j = 0; j < nS2; j++) {
+        bel[i*maxStates+j] = belN1[i] * belN2[j] * pot[i*maxStates+j];
+        sum += bel[i*maxStates+j];
+      }
+    }
+
+    // normalize
+    if (sum == 0) return false;
+    for (long i = 0; i < nS1; i++) {
+      for (long j = 0; j < nS2; j++) {
+        bel[i*maxStates+j] /= sum;
+      }
+    }
+  }
+  return true;
+}
+
+template <typename real>
+double bpComputeLogZ(const Graph<real> &g, const real *nodePot,
+                     const real *edgePot, real *nodeBel, real *edgeBel) {
+  long nNodes = g.nNodes;
+  long nEdges = g.nEdges;
+  long maxStates = g.maxStates;
+  const real *nStates = g.nStates;
+  const real *edgeEnds = g.edgeEnds;
+  const real *V = g.V;
+
+  // add epsilon to beliefs
+  real eps = 1e-15;
+  for (long i = 0; i < nNodes*maxStates; i++) nodeBel[i] += eps;
+  for (long i = 0; i < nEdges*maxStates*maxStates; i++) edgeBel[i] += eps;
+
+  // vars
+  double eng1 = 0;
+  double eng2 = 0;
+  double ent1 = 0;
+  double ent2 = 0;
+
+  // wrt nodes
+  for (long n = 0; n < nNodes; n++) {
+    // find neighbors of node n (Lua: local edges = graph:getEdgesOf(n)
+    long nEdgesOfNode = (long)(V[n+1]-V[n]);
+    const real *bel = nodeBel + n*maxStates;
+    const real *pot = nodePot + n*maxStates;
+
+    // node entropy and energy
+    double ent = 0, eng = 0;
+    for (long s = 0; s < nStates[n]; s++) {
+      ent += bel[s] * log(bel[s]);
+      eng += bel[s] * log(pot[s]);
+    }
+    ent1 += (nEdgesOfNode-1) * ent;
+    eng1 -= eng;
+  }
+
+  // wrt edges
+  for (long e = 0; e < nEdges; e++) {
+    // get edge of interest, and its nodes
+    long n1 = edgeEnds[e*2+0]-1;
+    long n2 = edgeEnds[e*2+1]-1;
+    const real *bel = edgeBel + e*maxStates*maxStates;
+    const real *pot = edgePot + e*maxStates*maxStates;
+
+    // edge entropy and energy
+    double ent = 0, eng = 0;
+    for (long i = 0; i < nStates[n1]; i++) {
+      for (long j = 0; j < nStates[n2]; j++) {
+        ent += bel[i*maxStates+j] * log(bel[i*maxStates+j]);
+        eng += bel[i*maxStates+j] * log(pot[i*maxStates+j]);
+      }
+    }
+    ent2 -= ent;
+    eng2 -= eng;
+  }
+
+  // free energy
+  double F = (eng1+eng2) - (ent1+ent2);
+  return -F;
+}
+
+template <typename real>
+bool bpComputeBeliefs(const Graph<real> &g, const real *nodePot,
+                      const real *edgePot, const real *msg,
+                      real *nodeBel, real *edgeBel, double *logZ) {
+  DensePotentials<real> pot = {edgePot, g.maxStates};
+  return computeBeliefs(g, nodePot, pot, msg, nodeBel, edgeBel, logZ);
+}
+
+// message passing until convergence, shared by inferBP and decodeBP
+template <typename real, typename Pot, typename msg_t>
+static long runBP(const Graph<real> &g, const real *nodePot,
+                  const Pot &edgePot, long maxIter, bool maxprod,
+                  std::vector<msg_t> &msg) {
+  long size = g.nEdges*2*g.maxStates;
+  msg.assign(size, 0);
+  std::vector<msg_t> msg_old(size, 0);
+
+  // propagate state normalizations
+  initMessages(g, &msg[0]);
+
+  // do loopy belief propagation (if maxIter = 1, it's regular bp)
+  long idx = 0;
+  for (long i = 1; i <= maxIter; i++) {
+    idx = i;
+    if (!sweep(g, nodePot, edgePot, &msg[0], maxprod)) return 0;
+
+    // check convergence
+    double diff = 0;
+    for (long k = 0; k < size; k++) {
+      diff += fabs(loadMessage(msg[k]) - loadMessage(msg_old[k]));
+    }
+    if (diff < 1e-4) break;
+    msg_old = msg;
+  }
+  return idx;
+}
+
+template <typename real, typename Pot, typename msg_t>
+static long runInferBP(const Graph<real> &g, const real *nodePot,
+                       const Pot &edgePot, long maxIter, real *nodeBel,
+                       real *edgeBel, double *logZ) {
+  std::vector<msg_t> msg;
+  long iters = runBP(g, nodePot, edgePot, maxIter, false, msg);
+  if (iters == 0) return 0;
+
+  memset(nodeBel, 0, sizeof(real)*g.nNodes*g.maxStates);
+  memset(edgeBel, 0, sizeof(real)*g.nEdges*g.maxStates*g.maxStates);
+  if (!computeBeliefs(g, nodePot, edgePot, &msg[0], nodeBel, edgeBel, logZ)) return 0;
+  return iters;
+}
+
+template <typename real, typename Pot, typename msg_t>
+static long runDecodeBP(const Graph<real> &g, const real *nodePot,
+                        const Pot &edgePot, long maxIter, real *nodeBel,
+                        long *config) {
+  std::vector<msg_t> msg;
+  long iters = runBP(g, nodePot, edgePot, maxIter, true, msg);
+  if (iters == 0) return 0;
+
+  memset(nodeBel, 0, sizeof(real)*g.nNodes*g.maxStates);
+  if (!computeNodeBeliefs(g, nodePot, &msg[0], nodeBel)) return 0;
+
+  // get argmax of nodeBel: that's the optimal config
+  for (long n = 0; n < g.nNodes; n++) {
+    const real *bel = nodeBel + n*g.maxStates;
+    long best = 0;
+    for (long s = 1; s < g.nStates[n]; s++) {
+      if (bel[s] > bel[best]) best = s;
+    }
+    config[n] = best+1;
+  }
+  return iters;
+}
+
+template <typename real>
+long inferBP(const Graph<real> &g, const real *nodePot, const real *edgePot,
+             long maxIter, real *nodeBel, real *edgeBel, double *logZ) {
+  DensePotentials<real> pot = {edgePot, g.maxStates};
+  return runInferBP<real, DensePotentials<real>, real>(g, nodePot, pot, maxIter,
+                                                       nodeBel, edgeBel, logZ);
+}
+
+template <typename real>
+long decodeBP(const Graph<real> &g, const real *nodePot, const real *edgePot,
+              long maxIter, real *nodeBel, long *config) {
+  DensePotentials<real> pot = {edgePot, g.maxStates};
+  return runDecodeBP<real, DensePotentials<real>, real>(g, nodePot, pot, maxIter,
+                                                        nodeBel, config);
+}
+
+template <typename real>
+long inferBP(const Graph<real> &g, const real *nodePot,
+             const CompactPotentials &edgePot, bool halfMessages,
+             long maxIter, real *nodeBel, real *edgeBel, double *logZ) {
+  PackedPotentials<real> pot = {edgePot};
+  if (halfMessages) {
+    return runInferBP<real, PackedPotentials<real>, uint16_t>(g, nodePot, pot, maxIter,
+                                                              nodeBel, edgeBel, logZ);
+  }
+  return runInferBP<real, PackedPotentials<real>, real>(g, nodePot, pot, maxIter,
+                                                        nodeBel, edgeBel, logZ);
+}
+
+template <typename real>
+long decodeBP(const Graph<real> &g, const real *nodePot,
+              const CompactPotentials &edgePot, bool halfMessages,
+              long maxIter, real *nodeBel, long *config) {
+  PackedPotentials<real> pot = {edgePot};
+  if (halfMessages) {
+    return runDecodeBP<real, PackedPotentials<real>, uint16_t>(g, nodePot, pot, maxIter,
+                                                               nodeBel, config);
+  }
+  return runDecodeBP<real, PackedPotentials<real>, real>(g, nodePot, pot, maxIter,
+                                                         nodeBel, config);
+}
+
+// Sparse messages of beam BP: each directed message lists at most
+// capacity (state, value) entries, and spreads the rest of its unit mass
+// evenly (floor) over the other states of its target.
+template <typename real>
+struct SparseMessages {
+  long capacity;
+  std::vector<long> count;   // 2E
+  std::vector<int> index;    // 2E x capacity
+  std::vector<real> value;   // 2E x capacity
+  std::vector<real> floor;   // 2E
+
+  void expand(long m, long nS, real *dense) const {
+    for (long s = 0; s < nS; s++) dense[s] = floor[m];
+    for (long j = 0; j < count[m]; j++) dense[index[m*capacity+j]] = value[m*capacity+j];
+  }
+};
+
+template <typename real>
+struct ValueGreater {
+  const real *x;
+  bool operator()(int a, int b) const { return x[a] > x[b]; }
+};
+
+// Keeps the top-k entries of x (k = 0: no limit) whose share of sum is at
+// least threshold; fills keep (sorted by decreasing value, at least one
+// entry), and returns the share of sum they hold.
+template <typename real>
+static double pruneStates(const real *x, long n, double sum, long k,
+                          double threshold, std::vector<int> &keep) {
+  keep.resize(n);
+  for (long s = 0; s < n; s++) keep[s] = s;
+  long nKeep = (k > 0 && k < n) ? k : n;
+  ValueGreater<real> greater = {x};
+  std::partial_sort(keep.begin(), keep.begin()+nKeep, keep.end(), greater);
+  double kept = 0;
+  long i = 0;
+  for (; i < nKeep; i++) {
+    if (i > 0 && x[keep[i]] < threshold*sum) break;
+    kept += x[keep[i]];
+  }
+  keep.resize(i);
+  return (sum > 0) ? kept/sum : 1;
+}
+
+// Scratch space of beamProduct (nStates entries each).
+struct BeamScratch {
+  std::vector<double> ratio;
+  std::vector<long> hits;
+  explicit BeamScratch(long maxStates) : ratio(maxStates), hits(maxStates) {}
+};
+
+// Product of nodePot and of the messages into node n, except the one
+// through edge skip (-1: none), in O(nStates + kept entries): each message
+// is its floor everywhere, times value/floor on its kept states. Messages
+// with a zero floor (all of their mass kept) zero out the states they
+// don't list.
+template <typename real>
+static void beamProduct(const Graph<real> &g, const real *nodePot,
+                        const SparseMessages<real> &msg, long n, long skip,
+                        real *prod, BeamScratch &scratch) {
+  long nEdges = g.nEdges;
+  const real *edges = g.E + ((long)(g.V[n])-1);
+  long nEdgesOfNode = (long)(g.V[n+1]-g.V[n]);
+  long nS = g.nStates[n];
+  double *ratio = &scratch.ratio[0];
+  long *hits = &scratch.hits[0];
+  double floors = 1;
+  long nDense = 0;
+  for (long s = 0; s < nS; s++) ratio[s] = 1;
+  for (long k = 0; k < nEdgesOfNode; k++) {
+    long e = edges[k]-1;
+    if (e == skip) continue;
+    long m = (n == (long)g.edgeEnds[e*2+0]-1) ? e+nEdges : e;
+    const int *index = &msg.index[m*msg.capacity];
+    const real *value = &msg.value[m*msg.capacity];
+    double floor = msg.floor[m];
+    if (floor > 0) {
+      floors *= floor;
+      for (long j = 0; j < msg.count[m]; j++) ratio[index[j]] *= value[j] / floor;
+    } else {
+      if (nDense++ == 0) {
+        for (long s = 0; s < nS; s++) hits[s] = 0;
+      }
+      for (long j = 0; j < msg.count[m]; j++) {
+        ratio[index[j]] *= value[j];
+        hits[index[j]]++;
+      }
+    }
+  }
+  for (long s = 0; s < nS; s++) {
+    bool zero = nDense > 0 && hits[s] < nDense;
+    prod[s] = zero ? 0 : nodePot[n*g.maxStates+s] * (floors * ratio[s]);
+  }
+}
+
+// One sweep of beam message passing, in node order: each message only
+// sums (or maxes) over the beam of its source's cavity product, and keeps
+// the beam of its own entries. Sets diff (L1 change of all messages) and
+// dropped (largest mass dropped by an update: the share of the cavity
+// product outside the source beam, plus the share of the new message
+// outside its own entries).
+template <typename real>
+static bool computeBeamMessages(const Graph<real> &g, const real *nodePot,
+                                const real *edgePot, SparseMessages<real> &msg,
+                                long beam, double threshold, bool maxprod,
+                                double *diff, double *dropped) {
+  long nNodes = g.nNodes;
+  long nEdges = g.nEdges;
+  long maxStates = g.maxStates;
+  const real *nStates = g.nStates;
+  const real *edgeEnds = g.edgeEnds;
+  const real *E = g.E;
+  const real *V = g.V;
+
+  // temp structures
+  std::vector<real> prod(maxStates);
+  std::vector<real> out(maxStates);
+  std::vector<real> scratch(maxStates);
+  BeamScratch product(maxStates);
+  std::vector<int> source, target;
+  *diff = 0;
+  *dropped = 0;
+
+  for (long n = 0; n < nNodes; n++) {
+    const real *edges = E + ((long)(V[n])-1);
+    long nEdgesOfNode = (long)(V[n+1]-V[n]);
+    long nS = nStates[n];
+
+    // send a message to each neighbor of node n
+    for (long k = 0; k < nEdgesOfNode; k++) {
+      long e = edges[k]-1;
+      long n1 = edgeEnds[e*2+0]-1;
+      long n2 = edgeEnds[e*2+1]-1;
+
+      // cavity product, and its beam
+      beamProduct(g, nodePot, msg, n, e, &prod[0], product);
+      double sum = 0;
+      for (long s = 0; s < nS; s++) sum += prod[s];
+      if (sum == 0) return false;
+      double lost = 1 - pruneStates(&prod[0], nS, sum, beam, threshold, source);
+
+      // O(beam x nOut) product with the joint potential
+      const real *pot_ij = edgePot + e*maxStates*maxStates;
+      long m, nOut, si, sj;
+      if (n == n1) {
+        m = e;
+        nOut = nStates[n2]; si = 1; sj = maxStates;
+      } else {
+        m = e+nEdges;
+        nOut = nStates[n1]; si = maxStates; sj = 1;
+      }
+      for (long i = 0; i < nOut; i++) out[i] = 0;
+      for (size_t b = 0; b < source.size(); b++) {
+        long j = source[b];
+        real p = prod[j];
+        const real *col = pot_ij + j*sj;
+        if (maxprod) {
+          for (long i = 0; i < nOut; i++) {
+            real product = col[i*si] * p;
+            if (product > out[i]) out[i] = product;
+          }
+        } else {
+          for (long i = 0; i < nOut; i++) out[i] += col[i*si] * p;
+        }
+      }
+
+      // normalize, and keep the beam of the message itself
+      sum = 0;
+      for (long i = 0; i < nOut; i++) sum += out[i];
+      if (sum == 0) return false;
+      for (long i = 0; i < nOut; i++) out[i] /= sum;
+      double kept = pruneStates(&out[0], nOut, 1.0, beam, threshold, target);
+      lost += 1 - kept;
+      if (lost > *dropped) *dropped = lost;
+
+      // store, and measure the change
+      msg.expand(m, nOut, &scratch[0]);
+      long nKeep = target.size();
+      real floor = (nOut > nKeep) ? (1 - kept) / (nOut - nKeep) : 0;
+      msg.count[m] = nKeep;
+      msg.floor[m] = floor;
+      for (long j = 0; j < nKeep; j++) {
+        msg.index[m*msg.capacity+j] = target[j];
+        msg.value[m*msg.capacity+j] = out[target[j]];
+      }
+      msg.expand(m, nOut, &out[0]);
+      for (long i = 0; i < nOut; i++) *diff += fabs(out[i] - scratch[i]);
+    }
+  }
+  return true;
+}
+
+// beam message passing until convergence, shared by inferBeamBP and
+// decodeBeamBP
+template <typename real>
+static long runBeamBP(const Graph<real> &g, const real *nodePot,
+                      const real *edgePot, long beam, double threshold,
+                      long maxIter, bool maxprod, SparseMessages<real> &msg,
+                      double *dropped) {
+  long nEdges = g.nEdges;
+  const real *edgeEnds = g.edgeEnds;
+  const real *nStates = g.nStates;
+
+  // uniform messages: no entries, only a floor
+  msg.capacity = (beam > 0 && beam < g.maxStates) ? beam : g.maxStates;
+  msg.count.assign(nEdges*2, 0);
+  msg.index.assign(nEdges*2*msg.capacity, 0);
+  msg.value.assign(nEdges*2*msg.capacity, 0);
+  msg.floor.assign(nEdges*2, 0);
+  for (long e = 0; e < nEdges; e++) {
+    msg.floor[e] = 1/nStates[(long)edgeEnds[e*2+1]-1];
+    msg.floor[e+nEdges] = 1/nStates[(long)edgeEnds[e*2+0]-1];
+  }
+
+  long idx = 0;
+  for (long i = 1; i <= maxIter; i++) {
+    idx = i;
+    double diff;
+    if (!computeBeamMessages(g, nodePot, edgePot, msg, beam, threshold,
+                             maxprod, &diff, dropped)) return 0;
+    if (diff < 1e-4) break;
+  }
+  return idx;
+}
+
+template <typename real>
+long inferBeamBP(const Graph<real> &g, const real *nodePot, const real *edgePot,
+                 long beam, double threshold, long maxIter,
+                 real *nodeBel, real *edgeBel, double *logZ, double *dropped) {
+  SparseMessages<real> msg;
+  long iters = runBeamBP(g, nodePot, edgePot, beam, threshold, maxIter, false,
+                         msg, dropped);
+  if (iters == 0) return 0;
+
+  // beliefs are dense outputs: expand the messages once
+  long maxStates = g.maxStates;
+  std::vector<real> dense(g.nEdges*2*maxStates, 0);
+  for (long e = 0; e < g.nEdges; e++) {
+    msg.expand(e, g.nStates[(long)g.edgeEnds[e*2+1]-1], &dense[e*maxStates]);
+    msg.expand(e+g.nEdges, g.nStates[(long)g.edgeEnds[e*2+0]-1], &dense[(e+g.nEdges)*maxStates]);
+  }
+  memset(nodeBel, 0, sizeof(real)*g.nNodes*maxStates);
+  memset(edgeBel, 0, sizeof(real)*g.nEdges*maxStates*maxStates);
+  DensePotentials<real> pot = {edgePot, maxStates};
+  if (!computeBeliefs(g, nodePot, pot, &dense[0], nodeBel, edgeBel, logZ)) return 0;
+  return iters;
+}
+
+template <typename real>
+long decodeBeamBP(const Graph<real> &g, const real *nodePot, const real *edgePot,
+                  long beam, double threshold, long maxIter,
+                  real *nodeBel, long *config, double *dropped) {
+  SparseMessages<real> msg;
+  long iters = runBeamBP(g, nodePot, edgePot, beam, threshold, maxIter, true,
+                         msg, dropped);
+  if (iters == 0) return 0;
+
+  // node beliefs straight from the sparse messages, and their argmax
+  long maxStates = g.maxStates;
+  BeamScratch scratch(maxStates);
+  memset(nodeBel, 0, sizeof(real)*g.nNodes*maxStates);
+  for (long n = 0; n < g.nNodes; n++) {
+    real *bel = nodeBel + n*maxStates;
+    long nS = g.nStates[n];
+    beamProduct(g, nodePot, msg, n, -1, bel, scratch);
+    double sum = 0;
+    long best = 0;
+    for (long s = 0; s < nS; s++) {
+      sum += bel[s];
+      if (bel[s] > bel[best]) best = s;
+    }
+    if (sum == 0) return 0;
+    for (long s = 0; s < nS; s++) bel[s] /= sum;
+    config[n] = best+1;
+  }
+  return iters;
+}
+
+#define GM_INSTANTIATE(real) \
+  template void bpInitMessages<real>(const Graph<real> &, real *); \
+  template bool bpComputeMessages<real>(const Graph<real> &, const real *, const real *, real *, bool); \
+  template bool bpComputeNodeBeliefs<real>(const Graph<real> &, const real *, const real *, real *); \
+  template bool bpComputeEdgeBeliefs<real>(const Graph<real> &, const real *, const real *, const real *, real *); \
+  template double bpComputeLogZ<real>(const Graph<real> &, const real *, const real *, real *, real *); \
+  template bool bpComputeBeliefs<real>(const Graph<real> &, const real *, const real *, const real *, real *, real *, double *); \
+  template long inferBP<real>(const Graph<real> &, const real *, const real *, long, real *, real *, double *); \
+  template long decodeBP<real>(const Graph<real> &, const real *, const real *, long, real *, long *); \
+  template long inferBP<real>(const Graph<real> &, const real *, const CompactPotentials &, bool, long, real *, real *, double *); \
+  template long decodeBP<real>(const Graph<real> &, const real *, const CompactPotentials &, bool, long, real *, long *); \
+  template long inferBeamBP<real>(const Graph<real> &, const real *, const real *, long, double, long, real *, real *, double *, double *); \
+  template long decodeBeamBP<real>(const Graph<real> &, const real *, const real *, long, double, long, real *, long *, double *);
+
+GM_INSTANTIATE(float)
+GM_INSTANTIATE(double)
+
+}
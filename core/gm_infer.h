@@ -0,0 +1,99 @@
+#ifndef GM_INFER_H
+#define GM_INFER_H
+
+#include "gm_compact.h"
+#include "gm_graph.h"
+
+namespace gm {
+
+// Belief propagation kernels. All buffers are contiguous, with rows padded
+// to g.maxStates:
+//   nodePot, nodeBel: N x maxStates
+//   edgePot, edgeBel: E x maxStates x maxStates
+//   msg:              2E x maxStates (rows 0..E-1 go n1->n2, E..2E-1 n2->n1)
+// The kernels that normalize return false when a normalizer underflows.
+
+// Initializes all messages to uniform distributions.
+template <typename real>
+void bpInitMessages(const Graph<real> &g, real *msg);
+
+// One sweep of (loopy) message passing, in node order; maxprod selects
+// max-product instead of sum-product.
+template <typename real>
+bool bpComputeMessages(const Graph<real> &g, const real *nodePot,
+                       const real *edgePot, real *msg, bool maxprod);
+
+// Normalized node beliefs from converged messages.
+template <typename real>
+bool bpComputeNodeBeliefs(const Graph<real> &g, const real *nodePot,
+                          const real *msg, real *nodeBel);
+
+// Normalized edge beliefs from node beliefs and messages.
+template <typename real>
+bool bpComputeEdgeBeliefs(const Graph<real> &g, const real *edgePot,
+                          const real *nodeBel, const real *msg, real *edgeBel);
+
+// Bethe approximation of log(Z). Adds eps to nodeBel/edgeBel in place.
+template <typename real>
+double bpComputeLogZ(const Graph<real> &g, const real *nodePot,
+                     const real *edgePot, real *nodeBel, real *edgeBel);
+
+// Node beliefs, edge beliefs and the Bethe approximation of log(Z) in one
+// pass, parallel over nodes and then over edges. Unlike bpComputeLogZ,
+// beliefs are left untouched (eps only enters the logs).
+template <typename real>
+bool bpComputeBeliefs(const Graph<real> &g, const real *nodePot,
+                      const real *edgePot, const real *msg,
+                      real *nodeBel, real *edgeBel, double *logZ);
+
+// Full sum-product inference, as gm.infer.bp: fills nodeBel, edgeBel and
+// logZ, and returns the nb of iterations done (0 on underflow).
+template <typename real>
+long inferBP(const Graph<real> &g, const real *nodePot, const real *edgePot,
+             long maxIter, real *nodeBel, real *edgeBel, double *logZ);
+
+// Full max-product decoding, as gm.decode.bp: fills nodeBel and the
+// 1-based optimal config (N), and returns the nb of iterations done
+// (0 on underflow).
+template <typename real>
+long decodeBP(const Graph<real> &g, const real *nodePot, const real *edgePot,
+              long maxIter, real *nodeBel, long *config);
+
+// Same as inferBP/decodeBP, with edge potentials in compact storage, and
+// messages stored as fp16 if halfMessages. Each table is decoded once per
+// sweep (which then runs in edge order), messages as they are read, and
+// all arithmetic is done in real.
+template <typename real>
+long inferBP(const Graph<real> &g, const real *nodePot,
+             const CompactPotentials &edgePot, bool halfMessages,
+             long maxIter, real *nodeBel, real *edgeBel, double *logZ);
+
+template <typename real>
+long decodeBP(const Graph<real> &g, const real *nodePot,
+              const CompactPotentials &edgePot, bool halfMessages,
+              long maxIter, real *nodeBel, long *config);
+
+// Beam BP, for large label spaces: each message is a sparse list of its
+// largest entries (at most beam of them, 0 = no limit, each holding at
+// least threshold of its mass), the rest of its mass being spread evenly
+// over the other states. Updates only sum (or max) over the same beam of
+// the sending node's cavity product, for O(beam x nStates) per message,
+// and cavity products only multiply the kept entries of each message.
+// dropped is set to the largest share of mass a single message update
+// dropped in the last sweep (outside the source's beam, plus outside the
+// message's own entries): a diagnostic of how much the beam truncates,
+// not a bound on the error of the beliefs. Beliefs are computed densely
+// from the converged messages.
+template <typename real>
+long inferBeamBP(const Graph<real> &g, const real *nodePot, const real *edgePot,
+                 long beam, double threshold, long maxIter,
+                 real *nodeBel, real *edgeBel, double *logZ, double *dropped);
+
+template <typename real>
+long decodeBeamBP(const Graph<real> &g, const real *nodePot, const real *edgePot,
+                  long beam, double threshold, long maxIter,
+                  real *nodeBel, long *config, double *dropped);
+
+}
+
+#endif
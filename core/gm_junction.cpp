@@ -0,0 +1,444 @@
+#include "gm_junction.h"
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <queue>
+#include <set>
+#include <vector>
+
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+namespace gm {
+
+// elimination score of node n: (fill-in or degree, log of its clique's
+// table size), lower is better
+template <typename real>
+static void eliminationScore(const Graph<real> &g, int heuristic,
+                             const std::vector<std::set<long> > &adj, long n,
+                             double *score, double *weight) {
+  const std::set<long> &nei = adj[n];
+  *weight = log((double)g.nStates[n]);
+  for (std::set<long>::const_iterator a = nei.begin(); a != nei.end(); ++a) {
+    *weight += log((double)g.nStates[*a]);
+  }
+  if (heuristic == kMinDegree) {
+    *score = nei.size();
+    return;
+  }
+  long fill = 0;
+  for (std::set<long>::const_iterator a = nei.begin(); a != nei.end(); ++a) {
+    std::set<long>::const_iterator b = a;
+    for (++b; b != nei.end(); ++b) {
+      if (!adj[*a].count(*b)) fill++;
+    }
+  }
+  *score = fill;
+}
+
+// elimination candidate, ordered so that the top of a priority queue is the
+// lowest (score, weight), ties going to the lowest node
+struct Candidate {
+  double score;
+  double weight;
+  long n;
+  Candidate(double score, double weight, long n) : score(score), weight(weight), n(n) {}
+  bool operator<(const Candidate &c) const {
+    if (score != c.score) return score > c.score;
+    if (weight != c.weight) return weight > c.weight;
+    return n > c.n;
+  }
+};
+
+template <typename real>
+void makeJunctionTree(const Graph<real> &g, int heuristic, JunctionTree &jt) {
+  long nNodes = g.nNodes;
+  long nEdges = g.nEdges;
+  const real *edgeEnds = g.edgeEnds;
+
+  // adjacency, filled in as nodes get eliminated
+  std::vector<std::set<long> > adj(nNodes);
+  for (long e = 0; e < nEdges; e++) {
+    long n1 = edgeEnds[e*2+0]-1;
+    long n2 = edgeEnds[e*2+1]-1;
+    if (n1 == n2) continue;
+    adj[n1].insert(n2);
+    adj[n2].insert(n1);
+  }
+  std::vector<double> score(nNodes), weight(nNodes);
+  std::vector<char> eliminated(nNodes, 0);
+  std::priority_queue<Candidate> queue;
+  for (long n = 0; n < nNodes; n++) {
+    eliminationScore(g, heuristic, adj, n, &score[n], &weight[n]);
+    queue.push(Candidate(score[n], weight[n], n));
+  }
+
+  jt.nNodes = nNodes;
+  jt.order.assign(nNodes, 0);
+  jt.offset.assign(nNodes+1, 0);
+  jt.nodes.clear();
+  jt.parent.assign(nNodes, -1);
+  jt.nodeClique.assign(nNodes, 0);
+  jt.cost = 0;
+  jt.width = 0;
+
+  // greedy elimination: nodes are re-queued when their score changes, and
+  // entries that are out of date are skipped
+  for (long i = 0; i < nNodes; i++) {
+    long best;
+    for (;;) {
+      Candidate c = queue.top();
+      queue.pop();
+      if (!eliminated[c.n] && c.score == score[c.n] && c.weight == weight[c.n]) {
+        best = c.n;
+        break;
+      }
+    }
+
+    // new clique: best and its remaining neighbours
+    std::vector<long> nei(adj[best].begin(), adj[best].end());
+    jt.order[i] = best;
+    jt.nodeClique[best] = i;
+    jt.nodes.push_back(best);
+    jt.nodes.insert(jt.nodes.end(), nei.begin(), nei.end());
+    jt.offset[i+1] = jt.nodes.size();
+    jt.cost += exp(weight[best]);
+    jt.width = std::max(jt.width, (long)nei.size());
+
+    // connect its neighbours, and remove it
+    for (size_t a = 0; a < nei.size(); a++) {
+      for (size_t b = a+1; b < nei.size(); b++) {
+        adj[nei[a]].insert(nei[b]);
+        adj[nei[b]].insert(nei[a]);
+      }
+      adj[nei[a]].erase(best);
+    }
+    adj[best].clear();
+    eliminated[best] = 1;
+
+    // only the neighbourhoods of its neighbours have changed
+    std::set<long> changed(nei.begin(), nei.end());
+    for (size_t a = 0; a < nei.size(); a++) {
+      changed.insert(adj[nei[a]].begin(), adj[nei[a]].end());
+    }
+    for (std::set<long>::iterator n = changed.begin(); n != changed.end(); ++n) {
+      double oldScore = score[*n], oldWeight = weight[*n];
+      eliminationScore(g, heuristic, adj, *n, &score[*n], &weight[*n]);
+      if (score[*n] != oldScore || weight[*n] != oldWeight) {
+        queue.push(Candidate(score[*n], weight[*n], *n));
+      }
+    }
+  }
+
+  // parent = clique of the first separator node to be eliminated
+  for (long i = 0; i < nNodes; i++) {
+    for (long k = jt.offset[i]+1; k < jt.offset[i+1]; k++) {
+      long c = jt.nodeClique[jt.nodes[k]];
+      if (jt.parent[i] < 0 || c < jt.parent[i]) jt.parent[i] = c;
+    }
+  }
+}
+
+// Walks the entries of a clique table in order (last node fastest), while
+// tracking the matching entry of another table, given the stride of each
+// clique node in that table (0 for nodes it doesn't depend on).
+struct TableWalk {
+  long nVars;
+  const long *card;
+  const long *stride;
+  std::vector<long> x;
+  long sub;
+
+  TableWalk(long nVars, const long *card, const long *stride)
+    : nVars(nVars), card(card), stride(stride), x(nVars, 0), sub(0) {}
+
+  void next() {
+    for (long k = nVars-1; k >= 0; k--) {
+      sub += stride[k];
+      if (++x[k] < card[k]) return;
+      sub -= stride[k]*card[k];
+      x[k] = 0;
+    }
+  }
+};
+
+// Clique tables, in doubles. Clique i lists order[i] first, so its table is
+// nStates[order[i]] consecutive blocks laid out like its separator's table.
+struct CliqueTables {
+  std::vector<long> card;         // per clique node
+  std::vector<long> stride;       // per clique node
+  std::vector<long> tableOffset;  // N+1
+  std::vector<long> sepOffset;    // N+1
+  std::vector<double> table;
+  std::vector<double> sep;        // messages sent up, over separators
+};
+
+// strides of the nodes of clique c into a table over nodes sub (with
+// strides subStride), 0 for the nodes that aren't in sub
+static void subStrides(const JunctionTree &jt, long c, long nSub,
+                       const long *sub, const long *subStride, long *out) {
+  for (long k = jt.offset[c]; k < jt.offset[c+1]; k++) {
+    out[k-jt.offset[c]] = 0;
+    for (long j = 0; j < nSub; j++) {
+      if (jt.nodes[k] == sub[j]) out[k-jt.offset[c]] = subStride[j];
+    }
+  }
+}
+
+// Builds the clique tables from the potentials, and passes messages up the
+// tree (sum or max of products), scaling each one to sum (or max) to 1.
+// Each clique ends up with its own factors times the messages of its
+// children; the log of the scales is accumulated into logScale.
+template <typename real>
+static bool collect(const Graph<real> &g, const JunctionTree &jt,
+                    const real *nodePot, const real *edgePot, bool maxprod,
+                    CliqueTables &t, double *logScale) {
+  long nNodes = g.nNodes;
+  long nEdges = g.nEdges;
+  long maxStates = g.maxStates;
+  const real *edgeEnds = g.edgeEnds;
+
+  // layout
+  t.card.resize(jt.nodes.size());
+  t.stride.resize(jt.nodes.size());
+  t.tableOffset.assign(nNodes+1, 0);
+  t.sepOffset.assign(nNodes+1, 0);
+  for (long i = 0; i < nNodes; i++) {
+    long size = 1;
+    for (long k = jt.offset[i+1]-1; k >= jt.offset[i]; k--) {
+      t.card[k] = g.nStates[jt.nodes[k]];
+      t.stride[k] = size;
+      size *= t.card[k];
+    }
+    t.tableOffset[i+1] = t.tableOffset[i] + size;
+    t.sepOffset[i+1] = t.sepOffset[i] + size / t.card[jt.offset[i]];
+  }
+  t.table.assign(t.tableOffset[nNodes], 1);
+  t.sep.assign(t.sepOffset[nNodes], 0);
+
+  // edges of each clique: the one that eliminates the first of its ends
+  std::vector<long> edgeOffset(nNodes+1, 0), edgesOf(nEdges);
+  for (long e = 0; e < nEdges; e++) {
+    long c = std::min(jt.nodeClique[(long)edgeEnds[e*2+0]-1],
+                      jt.nodeClique[(long)edgeEnds[e*2+1]-1]);
+    edgeOffset[c+1]++;
+  }
+  for (long i = 0; i < nNodes; i++) edgeOffset[i+1] += edgeOffset[i];
+  std::vector<long> fill(edgeOffset.begin(), edgeOffset.end()-1);
+  for (long e = 0; e < nEdges; e++) {
+    long c = std::min(jt.nodeClique[(long)edgeEnds[e*2+0]-1],
+                      jt.nodeClique[(long)edgeEnds[e*2+1]-1]);
+    edgesOf[fill[c]++] = e;
+  }
+
+  // multiply factors into their cliques
+#pragma omp parallel for schedule(dynamic)
+  for (long c = 0; c < nNodes; c++) {
+    long nVars = jt.offset[c+1] - jt.offset[c];
+    const long *card = &t.card[jt.offset[c]];
+    double *table = &t.table[t.tableOffset[c]];
+    long size = t.tableOffset[c+1] - t.tableOffset[c];
+    std::vector<long> strides(nVars);
+
+    // node potential of the eliminated node
+    long n = jt.order[c];
+    const long one = 1;
+    subStrides(jt, c, 1, &n, &one, &strides[0]);
+    const real *pot = nodePot + n*maxStates;
+    TableWalk wn(nVars, card, &strides[0]);
+    for (long k = 0; k < size; k++, wn.next()) table[k] *= pot[wn.sub];
+
+    // edge potentials (n1 x n2, row stride maxStates)
+    for (long k = edgeOffset[c]; k < edgeOffset[c+1]; k++) {
+      long e = edgesOf[k];
+      long ends[2] = {(long)edgeEnds[e*2+0]-1, (long)edgeEnds[e*2+1]-1};
+      long potStrides[2] = {maxStates, 1};
+      subStrides(jt, c, 2, ends, potStrides, &strides[0]);
+      const real *pot = edgePot + e*maxStates*maxStates;
+      TableWalk we(nVars, card, &strides[0]);
+      for (long j = 0; j < size; j++, we.next()) table[j] *= pot[we.sub];
+    }
+  }
+
+  // collect messages, children before parents
+  *logScale = 0;
+  for (long i = 0; i < nNodes; i++) {
+    long p = jt.parent[i];
+    if (p < 0) continue;
+    long nS = t.card[jt.offset[i]];
+    long sepSize = t.sepOffset[i+1] - t.sepOffset[i];
+    const double *table = &t.table[t.tableOffset[i]];
+    double *msg = &t.sep[t.sepOffset[i]];
+
+    // sum (or max) out the eliminated node
+    for (long s = 0; s < sepSize; s++) msg[s] = table[s];
+    for (long x = 1; x < nS; x++) {
+      const double *block = table + x*sepSize;
+      if (maxprod) {
+        for (long s = 0; s < sepSize; s++) if (block[s] > msg[s]) msg[s] = block[s];
+      } else {
+        for (long s = 0; s < sepSize; s++) msg[s] += block[s];
+      }
+    }
+
+    // scale
+    double norm = 0;
+    for (long s = 0; s < sepSize; s++) {
+      if (maxprod) norm = std::max(norm, msg[s]);
+      else norm += msg[s];
+    }
+    if (norm == 0) return false;
+    for (long s = 0; s < sepSize; s++) msg[s] /= norm;
+    *logScale += log(norm);
+
+    // multiply into the parent
+    long nVars = jt.offset[p+1] - jt.offset[p];
+    std::vector<long> strides(nVars);
+    subStrides(jt, p, jt.offset[i+1]-jt.offset[i]-1, &jt.nodes[jt.offset[i]+1],
+               &t.stride[jt.offset[i]+1], &strides[0]);
+    double *parent = &t.table[t.tableOffset[p]];
+    long size = t.tableOffset[p+1] - t.tableOffset[p];
+    TableWalk w(nVars, &t.card[jt.offset[p]], &strides[0]);
+    for (long k = 0; k < size; k++, w.next()) parent[k] *= msg[w.sub];
+  }
+  return true;
+}
+
+template <typename real>
+bool inferJunctionTree(const Graph<real> &g, const JunctionTree &jt,
+                       const real *nodePot, const real *edgePot,
+                       real *nodeBel, real *edgeBel, double *logZ) {
+  long nNodes = g.nNodes;
+  long nEdges = g.nEdges;
+  long maxStates = g.maxStates;
+  const real *edgeEnds = g.edgeEnds;
+
+  // up
+  CliqueTables t;
+  double logScale;
+  if (!collect(g, jt, nodePot, edgePot, false, t, &logScale)) return false;
+
+  // down: roots hold Z (up to the scales); then each clique gets the
+  // marginal of its (calibrated) parent over their separator, in place
+  // of the message it sent up
+  *logZ = logScale;
+  std::vector<double> marginal;
+  for (long i = nNodes-1; i >= 0; i--) {
+    long p = jt.parent[i];
+    double *table = &t.table[t.tableOffset[i]];
+    long size = t.tableOffset[i+1] - t.tableOffset[i];
+    if (p >= 0) {
+      long sepSize = t.sepOffset[i+1] - t.sepOffset[i];
+      const double *msg = &t.sep[t.sepOffset[i]];
+      marginal.assign(sepSize, 0);
+
+      // parent marginal
+      long nVars = jt.offset[p+1] - jt.offset[p];
+      std::vector<long> strides(nVars);
+      subStrides(jt, p, jt.offset[i+1]-jt.offset[i]-1, &jt.nodes[jt.offset[i]+1],
+                 &t.stride[jt.offset[i]+1], &strides[0]);
+      const double *parent = &t.table[t.tableOffset[p]];
+      long parentSize = t.tableOffset[p+1] - t.tableOffset[p];
+      TableWalk w(nVars, &t.card[jt.offset[p]], &strides[0]);
+      for (long k = 0; k < parentSize; k++, w.next()) marginal[w.sub] += parent[k];
+
+      // update
+      for (long s = 0; s < sepSize; s++) marginal[s] = msg[s] > 0 ? marginal[s]/msg[s] : 0;
+      for (long k = 0; k < size; k += sepSize) {
+        for (long s = 0; s < sepSize; s++) table[k+s] *= marginal[s];
+      }
+    }
+
+    // normalize
+    double sum = 0;
+    for (long k = 0; k < size; k++) sum += table[k];
+    if (sum == 0) return false;
+    for (long k = 0; k < size; k++) table[k] /= sum;
+    if (p < 0) *logZ += log(sum);
+  }
+
+  // node and edge beliefs, from the cliques that hold them
+  memset(nodeBel, 0, sizeof(real)*nNodes*maxStates);
+  memset(edgeBel, 0, sizeof(real)*nEdges*maxStates*maxStates);
+#pragma omp parallel
+{
+  std::vector<long> strides(jt.width+1);
+  std::vector<double> bel(maxStates*maxStates);
+
+#pragma omp for
+  for (long n = 0; n < nNodes; n++) {
+    long c = jt.nodeClique[n];
+    long nVars = jt.offset[c+1] - jt.offset[c];
+    const long one = 1;
+    subStrides(jt, c, 1, &n, &one, &strides[0]);
+    const double *table = &t.table[t.tableOffset[c]];
+    long size = t.tableOffset[c+1] - t.tableOffset[c];
+    std::fill(bel.begin(), bel.begin()+maxStates, 0);
+    TableWalk w(nVars, &t.card[jt.offset[c]], &strides[0]);
+    for (long k = 0; k < size; k++, w.next()) bel[w.sub] += table[k];
+    for (long s = 0; s < g.nStates[n]; s++) nodeBel[n*maxStates+s] = bel[s];
+  }
+
+#pragma omp for
+  for (long e = 0; e < nEdges; e++) {
+    long ends[2] = {(long)edgeEnds[e*2+0]-1, (long)edgeEnds[e*2+1]-1};
+    long belStrides[2] = {maxStates, 1};
+    long c = std::min(jt.nodeClique[ends[0]], jt.nodeClique[ends[1]]);
+    long nVars = jt.offset[c+1] - jt.offset[c];
+    subStrides(jt, c, 2, ends, belStrides, &strides[0]);
+    const double *table = &t.table[t.tableOffset[c]];
+    long size = t.tableOffset[c+1] - t.tableOffset[c];
+    std::fill(bel.begin(), bel.end(), 0);
+    TableWalk w(nVars, &t.card[jt.offset[c]], &strides[0]);
+    for (long k = 0; k < size; k++, w.next()) bel[w.sub] += table[k];
+    for (long i = 0; i < g.nStates[ends[0]]; i++) {
+      for (long j = 0; j < g.nStates[ends[1]]; j++) {
+        edgeBel[(e*maxStates+i)*maxStates+j] = bel[i*maxStates+j];
+      }
+    }
+  }
+}
+  return true;
+}
+
+template <typename real>
+bool decodeJunctionTree(const Graph<real> &g, const JunctionTree &jt,
+                        const real *nodePot, const real *edgePot,
+                        long *config) {
+  long nNodes = g.nNodes;
+
+  // up, with max of products
+  CliqueTables t;
+  double logScale;
+  if (!collect(g, jt, nodePot, edgePot, true, t, &logScale)) return false;
+
+  // down: the separator of each clique is eliminated later, so it is
+  // already decoded, and only the clique's own node is left to choose
+  for (long i = nNodes-1; i >= 0; i--) {
+    long sepSize = t.sepOffset[i+1] - t.sepOffset[i];
+    long s = 0;
+    for (long k = jt.offset[i]+1; k < jt.offset[i+1]; k++) {
+      s += (config[jt.nodes[k]]-1) * t.stride[k];
+    }
+    const double *table = &t.table[t.tableOffset[i]];
+    long best = 0;
+    for (long x = 1; x < t.card[jt.offset[i]]; x++) {
+      if (table[x*sepSize+s] > table[best*sepSize+s]) best = x;
+    }
+    if (table[best*sepSize+s] == 0) return false;
+    config[jt.order[i]] = best+1;
+  }
+  return true;
+}
+
+#define GM_INSTANTIATE(real) \
+  template void makeJunctionTree<real>(const Graph<real> &, int, JunctionTree &); \
+  template bool inferJunctionTree<real>(const Graph<real> &, const JunctionTree &, const real *, const real *, real *, real *, double *); \
+  template bool decodeJunctionTree<real>(const Graph<real> &, const JunctionTree &, const real *, const real *, long *);
+
+GM_INSTANTIATE(float)
+GM_INSTANTIATE(double)
+
+}
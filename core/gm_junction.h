@@ -0,0 +1,54 @@
+#ifndef GM_JUNCTION_H
+#define GM_JUNCTION_H
+
+#include "gm_graph.h"
+
+namespace gm {
+
+// Junction tree of a graph, from a greedy triangulation: nodes are
+// eliminated one at a time, and each elimination creates one clique, made
+// of the eliminated node and its remaining neighbours (its separator).
+// The parent of a clique is the one that eliminates the first of its
+// separator nodes, which holds the whole separator; parents always come
+// later in the elimination order, and cliques with an empty separator are
+// roots (one per connected component).
+//
+// Building the tree is cheap and touches no potentials, so cost can be
+// checked before any clique table is allocated.
+enum { kMinFill = 0, kMinDegree = 1 };
+
+struct JunctionTree {
+  long nNodes;
+  std::vector<long> order;       // N: clique i eliminates node order[i]
+  std::vector<long> offset;      // N+1: offsets of each clique in nodes
+  std::vector<long> nodes;       // order[i], then its separator (sorted)
+  std::vector<long> parent;      // N: parent clique, -1 for roots
+  std::vector<long> nodeClique;  // N: clique that eliminates each node
+  double cost;                   // total nb of clique table entries
+  long width;                    // largest clique size, minus one
+};
+
+// Triangulates g with the min-fill or min-degree heuristic (ties go to
+// the smallest clique table).
+template <typename real>
+void makeJunctionTree(const Graph<real> &g, int heuristic, JunctionTree &jt);
+
+// Exact node beliefs, edge beliefs and log(Z), by two-pass (Hugin)
+// message passing over clique tables of jt.cost doubles in total. Returns
+// false if Z underflows.
+template <typename real>
+bool inferJunctionTree(const Graph<real> &g, const JunctionTree &jt,
+                       const real *nodePot, const real *edgePot,
+                       real *nodeBel, real *edgeBel, double *logZ);
+
+// Exact MAP configuration (1-based, N), by max-product message passing up
+// the tree and backtracking down. Returns false if all configurations
+// have a zero potential.
+template <typename real>
+bool decodeJunctionTree(const Graph<real> &g, const JunctionTree &jt,
+                        const real *nodePot, const real *edgePot,
+                        long *config);
+
+}
+
+#endif
@@ -0,0 +1,289 @@
+#include "gm_parallel.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+
+#ifdef _OPENMP
+#include "omp.h"
+#endif
+
+namespace gm {
+
+enum { kPoolStep = 1, kPoolQuit = 2 };
+
+struct WorkerPool::Control {
+  sem_t done;         // posted by each worker at the end of a step
+  int64_t command;
+  int64_t batchSize;
+};
+
+struct WorkerPool::Slot {
+  sem_t go;           // posted by the parent to start a step
+  int64_t failed;
+  double nll;
+  char error[256];
+};
+
+static long align64(long x) {
+  return (x + 63) & ~63L;
+}
+
+// CPU sets of the NUMA nodes of this host (empty if there is only one)
+static void numaNodes(std::vector<cpu_set_t> &nodes) {
+  nodes.clear();
+  for (int node = 0; node < 1024; node++) {
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+    FILE *f = fopen(path, "r");
+    if (!f) continue;
+
+    // ranges, as in "0-7,16-23"
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    int first, last;
+    char sep;
+    while (fscanf(f, "%d", &first) == 1) {
+      last = first;
+      if (fscanf(f, "%c", &sep) == 1 && sep == '-') {
+        if (fscanf(f, "%d", &last) != 1) break;
+        if (fscanf(f, "%c", &sep) != 1) sep = '\n';
+      }
+      for (int cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) CPU_SET(cpu, &cpus);
+      if (sep != ',') break;
+    }
+    fclose(f);
+    if (CPU_COUNT(&cpus) > 0) nodes.push_back(cpus);
+  }
+  if (nodes.size() < 2) nodes.clear();
+}
+
+WorkerPool::WorkerPool()
+  : nWorkers(0), nParams(0), realSize(0), dataOffset(0), dataStride(0),
+    base(NULL), size(0), isWorker(false) {}
+
+WorkerPool::~WorkerPool() {
+  stop();
+  if (base) {
+    if (!isWorker) {
+      sem_destroy(&control()->done);
+      for (long k = 0; k < nWorkers; k++) sem_destroy(&slot(k)->go);
+    }
+    munmap(base, size);
+  }
+}
+
+WorkerPool::Control *WorkerPool::control() const {
+  return (Control *)base;
+}
+
+WorkerPool::Slot *WorkerPool::slot(long worker) const {
+  return (Slot *)(base + align64(sizeof(Control)) + worker*align64(sizeof(Slot)));
+}
+
+// block 0 holds w, block k+1 the gradient of worker k
+char *WorkerPool::data(long block) const {
+  return base + dataOffset + block*dataStride;
+}
+
+const void *WorkerPool::grad(long worker) const {
+  return data(worker+1);
+}
+
+bool WorkerPool::create(long nWorkers, long nParams, long realSize) {
+  if (nWorkers < 1) {
+    err = "need at least one worker";
+    return false;
+  }
+  this->nWorkers = nWorkers;
+  this->nParams = nParams;
+  this->realSize = realSize;
+  dataOffset = align64(sizeof(Control)) + nWorkers*align64(sizeof(Slot));
+  dataStride = align64(nParams*realSize);
+  size = dataOffset + (nWorkers+1)*dataStride;
+
+  // shared segment, unlinked right away: the mapping is inherited by the
+  // workers, and nothing is left behind in /dev/shm
+  static int count = 0;
+  char name[64];
+  snprintf(name, sizeof(name), "/gm-pool-%d-%d", (int)getpid(), count++);
+  int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    err = std::string("can't create shared memory: ") + strerror(errno);
+    return false;
+  }
+  shm_unlink(name);
+  if (ftruncate(fd, size) != 0) {
+    err = std::string("can't size shared memory: ") + strerror(errno);
+    close(fd);
+    return false;
+  }
+  void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    err = std::string("can't map shared memory: ") + strerror(errno);
+    return false;
+  }
+  base = (char *)map;
+
+  // process-shared semaphores
+  sem_init(&control()->done, 1, 0);
+  for (long k = 0; k < nWorkers; k++) sem_init(&slot(k)->go, 1, 0);
+  return true;
+}
+
+long WorkerPool::spawn(bool numa) {
+  std::vector<cpu_set_t> nodes;
+  if (numa) numaNodes(nodes);
+
+  // don't let each worker flush a copy of pending output
+  fflush(stdout);
+  fflush(stderr);
+
+  pid_t parent = getpid();
+  for (long k = 0; k < nWorkers; k++) {
+    pid_t pid = fork();
+    if (pid < 0) {
+      err = std::string("can't fork: ") + strerror(errno);
+      stop();
+      return -2;
+    }
+    if (pid == 0) {
+      // worker: exit with the parent, and run on its own node
+      isWorker = true;
+      pids.clear();
+      prctl(PR_SET_PDEATHSIG, SIGTERM);
+      if (getppid() != parent) _exit(1);
+      if (!nodes.empty()) {
+        sched_setaffinity(0, sizeof(cpu_set_t), &nodes[k % nodes.size()]);
+      }
+#ifdef _OPENMP
+      // the parent's OpenMP threads weren't forked (see gm_parallel.h)
+      omp_set_num_threads(1);
+#endif
+      return k;
+    }
+    pids.push_back(pid);
+  }
+  return -1;
+}
+
+bool WorkerPool::step(const void *w, long batchSize, double *nll) {
+  if (pids.empty()) {
+    err = "pool has no running workers";
+    return false;
+  }
+
+  // publish w, and start all workers
+  memcpy(data(0), w, nParams*realSize);
+  control()->command = kPoolStep;
+  control()->batchSize = batchSize;
+  for (long k = 0; k < nWorkers; k++) {
+    slot(k)->failed = 0;
+    sem_post(&slot(k)->go);
+  }
+
+  // wait for all of them, checking that none died in the meantime
+  for (long done = 0; done < nWorkers; ) {
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    t.tv_nsec += 100000000;
+    if (t.tv_nsec >= 1000000000) {
+      t.tv_sec++;
+      t.tv_nsec -= 1000000000;
+    }
+    if (sem_timedwait(&control()->done, &t) == 0) {
+      done++;
+      continue;
+    }
+    if (errno == EINTR) continue;
+    for (long k = 0; k < nWorkers; k++) {
+      if (pids[k] > 0 && waitpid(pids[k], NULL, WNOHANG) == pids[k]) {
+        char msg[64];
+        snprintf(msg, sizeof(msg), "worker %ld died", k+1);
+        err = msg;
+        pids[k] = -1;
+        stop();
+        return false;
+      }
+    }
+  }
+
+  // total nll
+  *nll = 0;
+  for (long k = 0; k < nWorkers; k++) {
+    if (slot(k)->failed) {
+      char msg[64];
+      snprintf(msg, sizeof(msg), "worker %ld: ", k+1);
+      err = std::string(msg) + slot(k)->error;
+      return false;
+    }
+    *nll += slot(k)->nll;
+  }
+  return true;
+}
+
+void WorkerPool::stop() {
+  if (isWorker || !base) return;
+  control()->command = kPoolQuit;
+  for (size_t k = 0; k < pids.size(); k++) {
+    if (pids[k] > 0) sem_post(&slot(k)->go);
+  }
+  for (size_t k = 0; k < pids.size(); k++) {
+    if (pids[k] <= 0) continue;
+    while (waitpid(pids[k], NULL, 0) < 0 && errno == EINTR) {}
+  }
+  pids.clear();
+}
+
+bool WorkerPool::next(long worker, void *w, long *batchSize) {
+  while (sem_wait(&slot(worker)->go) != 0) {
+    if (errno != EINTR) return false;
+  }
+  if (control()->command == kPoolQuit) return false;
+  memcpy(w, data(0), nParams*realSize);
+  *batchSize = control()->batchSize;
+  return true;
+}
+
+void WorkerPool::finish(long worker, double nll, const void *grad,
+                        const char *error) {
+  Slot *s = slot(worker);
+  s->nll = nll;
+  if (grad) memcpy(data(worker+1), grad, nParams*realSize);
+  else memset(data(worker+1), 0, nParams*realSize);
+  if (error) {
+    s->failed = 1;
+    snprintf(s->error, sizeof(s->error), "%s", error);
+  }
+  sem_post(&control()->done);
+}
+
+template <typename real>
+void reduceGradients(const WorkerPool &pool, real *grad) {
+  long nParams = pool.params();
+  long nWorkers = pool.workers();
+#pragma omp parallel for
+  for (long i = 0; i < nParams; i++) {
+    double sum = 0;
+    for (long k = 0; k < nWorkers; k++) sum += ((const real *)pool.grad(k))[i];
+    grad[i] = sum;
+  }
+}
+
+#define GM_INSTANTIATE(real) \
+  template void reduceGradients<real>(const WorkerPool &, real *);
+
+GM_INSTANTIATE(float)
+GM_INSTANTIATE(double)
+
+}
@@ -0,0 +1,82 @@
+#ifndef GM_PARALLEL_H
+#define GM_PARALLEL_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include <string>
+#include <vector>
+
+namespace gm {
+
+// Pool of forked worker processes, for data-parallel training on a single
+// host. Parameters and per-worker results (nll, gradient) live in one POSIX
+// shared memory segment, and each step is driven by process-shared
+// semaphores:
+//   parent: step(w) -> every worker: next(w) ... finish(nll, grad)
+// Workers are forked from the calling process, so they start with a copy of
+// all its state (including a Lua interpreter), and are expected to loop on
+// next()/finish() until next() returns false. Values are reals of
+// realSize bytes.
+// libgomp isn't fork-safe: a worker forked after the parent ran an OpenMP
+// region can deadlock in its next one if that one starts threads. Workers
+// are therefore limited to a single OpenMP thread, and each process gets
+// its parallelism from the pool instead.
+class WorkerPool {
+ public:
+  WorkerPool();
+  ~WorkerPool();
+
+  bool create(long nWorkers, long nParams, long realSize);
+
+  // Forks the workers, optionally pinning worker k to the CPUs of NUMA
+  // node k % nb of nodes. Returns the worker index (0..nWorkers-1) in each
+  // worker, -1 in the parent, and -2 on failure.
+  long spawn(bool numa);
+
+  long workers() const { return nWorkers; }
+  long params() const { return nParams; }
+  long realBytes() const { return realSize; }
+  const char *error() const { return err.c_str(); }
+
+  // Parent: publishes w, runs one step on all workers, and waits for them;
+  // batchSize is passed through to the workers. Fills the total nll, and
+  // returns false if a worker failed or died.
+  bool step(const void *w, long batchSize, double *nll);
+  const void *grad(long worker) const;
+
+  // Parent: asks the workers to exit, and reaps them.
+  void stop();
+
+  // Worker: waits for the next step, and copies w. Returns false when the
+  // pool is stopped.
+  bool next(long worker, void *w, long *batchSize);
+  // Worker: publishes its results (grad can be NULL for a zero gradient,
+  // and error non-NULL if the step failed).
+  void finish(long worker, double nll, const void *grad, const char *error);
+
+ private:
+  struct Control;
+  struct Slot;
+  Control *control() const;
+  Slot *slot(long worker) const;
+  char *data(long block) const;
+
+  long nWorkers;
+  long nParams;
+  long realSize;
+  long dataOffset;  // w, then one gradient per worker, 64-byte aligned
+  long dataStride;
+  char *base;
+  long size;
+  bool isWorker;
+  std::vector<pid_t> pids;
+  std::string err;
+};
+
+// grad = sum of the workers' gradients of the last step.
+template <typename real>
+void reduceGradients(const WorkerPool &pool, real *grad);
+
+}
+
+#endif
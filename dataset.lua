@@ -0,0 +1,194 @@
+----------------------------------------------------------------------
+--
+-- Copyright (c) 2012 Clement Farabet
+--
+-- Permission is hereby granted, free of charge, to any person obtaining
+-- a copy of this software and associated documentation files (the
+-- "Software"), to deal in the Software without restriction, including
+-- without limitation the rights to use, copy, modify, merge, publish,
+-- distribute, sublicense, and/or sell copies of the Software, and to
+-- permit persons to whom the Software is furnished to do so, subject to
+-- the following conditions:
+--
+-- The above copyright notice and this permission notice shall be
+-- included in all copies or substantial portions of the Software.
+--
+-- THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+-- EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+-- MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+-- NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+-- LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+-- OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+-- WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+--
+----------------------------------------------------------------------
+-- description:
+--     gm.dataset - memory-mapped datasets of graph instances, for
+--                  training on sets that don't fit in memory
+--
+-- history:
+--     October 2026 - initial draft - agent
+----------------------------------------------------------------------
+
+-- that table contains the dataset functions
+gm.dataset = {}
+
+-- shortcuts
+local ceil = math.ceil
+local min = math.min
+
+-- an (empty) tensor of the given type, to reach its C routines
+local function typed(tensorType)
+   return torch.Tensor():type(tensorType or torch.getdefaulttensortype())
+end
+
+----------------------------------------------------------------------
+-- opens a dataset: tensors returned are views into the mapped file,
+-- so nothing is read until it is used
+--
+function gm.dataset.open(...)
+   -- usage
+   local args, filename, tensorType = dok.unpack(
+      {...},
+      'gm.dataset.open',
+      'map a dataset of graph instances',
+      {arg='filename', type='string', help='dataset file', req=true},
+      {arg='type', type='string', help='tensor type of the stored values', default=torch.getdefaulttensortype()}
+   )
+
+   -- map file
+   local lib = typed(tensorType).gm
+   local dataset = {}
+   dataset.handle, dataset.nInstances, dataset.nNodes, dataset.nEdges,
+      dataset.nNodeFeatures, dataset.nEdgeFeatures, dataset.topology = lib.datasetOpen(filename)
+
+   -- y (N), Xnode (F x N), Xedge (Fe x E), and edgeEnds (E x 2) if the
+   -- dataset stores one topology per instance
+   dataset.instance = function(d,i)
+      return lib.datasetInstance(d.handle,i)
+   end
+
+   -- Y (n x N), Xnode (n x F x N), Xedge (n x Fe x E) for instances
+   -- first..first+n-1, in the format expected by graph:nll()
+   dataset.batch = function(d,first,n)
+      return lib.datasetBatch(d.handle,first,n)
+   end
+
+   -- page instances first..first+n-1 in, in the background
+   dataset.prefetch = function(d,first,n)
+      lib.datasetPrefetch(d.handle,first,n)
+   end
+
+   dataset.reader = function(d,batchSize,shuffle)
+      return gm.dataset.reader(d,batchSize,shuffle)
+   end
+
+   return dataset
+end
+
+----------------------------------------------------------------------
+-- streaming minibatch reader: each call to reader:next() returns the
+-- next shard of batchSize consecutive instances, and pages the one
+-- after it in while the current one is used. Returns nil at the end
+-- of an epoch; reader:reset() starts a new one.
+--
+function gm.dataset.reader(dataset,batchSize,shuffle)
+   local reader = {}
+   local nShards = ceil(dataset.nInstances / batchSize)
+
+   -- first instance and size of a shard
+   local function shard(s)
+      local first = (s-1)*batchSize + 1
+      return first, min(batchSize, dataset.nInstances-first+1)
+   end
+
+   reader.reset = function(r)
+      r.shard = 0
+      if shuffle then
+         r.order = torch.randperm(nShards)
+      else
+         r.order = torch.range(1,nShards)
+      end
+      if nShards > 0 then
+         dataset:prefetch(shard(r.order[1]))
+      end
+   end
+
+   -- Y, Xnode, Xedge for a shared topology, or else a list of instances
+   -- {y=,Xnode=,Xedge=,edgeEnds=}
+   reader.next = function(r)
+      r.shard = r.shard + 1
+      if r.shard > nShards then return nil end
+      local first,n = shard(r.order[r.shard])
+
+      -- page the following shard in while this one is being used
+      if r.shard < nShards then
+         dataset:prefetch(shard(r.order[r.shard+1]))
+      end
+
+      if not dataset.topology then
+         return dataset:batch(first,n)
+      end
+      local instances = {}
+      for i = first,first+n-1 do
+         local y,Xnode,Xedge,edgeEnds = dataset:instance(i)
+         table.insert(instances, {y=y, Xnode=Xnode, Xedge=Xedge, edgeEnds=edgeEnds})
+      end
+      return instances
+   end
+
+   reader:reset()
+   return reader
+end
+
+----------------------------------------------------------------------
+-- creates a dataset, filled one instance at a time with writer:add()
+--
+function gm.dataset.writer(...)
+   -- usage
+   local args, filename, nInstances, nNodes, nEdges, nNodeFeatures, nEdgeFeatures, topology, tensorType = dok.unpack(
+      {...},
+      'gm.dataset.writer',
+      'create a dataset of graph instances',
+      {arg='filename', type='string', help='dataset file', req=true},
+      {arg='nInstances', type='number', help='nb of instances', req=true},
+      {arg='nNodes', type='number', help='nb of nodes (max nb if topology)', req=true},
+      {arg='nEdges', type='number', help='nb of edges (max nb if topology)', req=true},
+      {arg='nNodeFeatures', type='number', help='nb of node features', req=true},
+      {arg='nEdgeFeatures', type='number', help='nb of edge features', req=true},
+      {arg='topology', type='boolean', help='store edgeEnds with each instance', default=false},
+      {arg='type', type='string', help='tensor type of the stored values', default=torch.getdefaulttensortype()}
+   )
+
+   -- create file
+   local lib = typed(tensorType).gm
+   local writer = {}
+   writer.handle = lib.datasetWriterOpen(filename, nInstances, nNodes, nEdges,
+                                         nNodeFeatures, nEdgeFeatures, topology)
+
+   -- y (N), Xnode (F x N), Xedge (Fe x E), and edgeEnds (E x 2) if topology
+   writer.add = function(w,y,Xnode,Xedge,edgeEnds)
+      lib.datasetWriterAdd(w.handle,y,Xnode,Xedge,edgeEnds)
+   end
+
+   writer.close = function(w)
+      lib.datasetWriterClose(w.handle)
+   end
+
+   return writer
+end
+
+----------------------------------------------------------------------
+-- saves in-memory training tensors (as passed to graph:nll()) to a
+-- dataset file
+--
+function gm.dataset.save(filename,Y,Xnode,Xedge)
+   local writer = gm.dataset.writer{filename=filename, nInstances=Y:size(1),
+                                    nNodes=Y:size(2), nEdges=Xedge:size(3),
+                                    nNodeFeatures=Xnode:size(2), nEdgeFeatures=Xedge:size(2),
+                                    type=Xnode:type()}
+   for i = 1,Y:size(1) do
+      writer:add(Y[i]:type(Xnode:type()),Xnode[i],Xedge[i])
+   end
+   writer:close()
+end
@@ -48,7 +48,7 @@ end
 --
 function gm.decode.exact(graph)
    -- check args
-   if not graph.nodePot or not graph.edgePot then
+   if not graph.nodePot or not (graph.edgePot or graph.compactPot) then
       xlua.error('missing nodePot/edgePot, please call graph:setFactors(...)','decode')
    end
 
@@ -65,39 +65,59 @@ function gm.decode.exact(graph)
    local nStates = graph.nStates
 
    -- init
-   local config = ones(nNodes)
    local optimalconfig = ones(nNodes)
+   local nConfigs = nStates:prod()
+   local batch = 4096
 
-   -- decode, exactly
-   local maxpot = -1
-   while true do
-      -- get potential for configuration
-      local pot = graph:getPotentialForConfig(config)
+   -- decode, exactly: score all configurations natively, a batch at a time
+   local edgePot = graph:getEdgePot()
+   local maxpot = -math.huge
+   for first = 0,nConfigs-1,batch do
+      local configs = graph:getConfigs(first,math.min(batch,nConfigs-first))
+      local logpot = graph:getLogPotentialsForConfigs(configs,false,edgePot)
 
       -- compare configurations
-      if pot > maxpot then
-         maxpot = pot
-         optimalconfig:copy(config)
+      local best,idx = logpot:max(1)
+      if best[1] > maxpot then
+         maxpot = best[1]
+         optimalconfig:copy(configs[idx[1]])
       end
+   end
 
-      -- next config
-      local idx
-      for i = 1,nNodes do
-         idx = i
-         config[i] = config[i] + 1
-         if config[i] <= nStates[i] then
-            break
-         else
-            config[i] = 1
-         end
-      end
+   -- store and return optimal config
+   graph.optimal = optimalconfig
+   return optimalconfig
+end
 
-      -- stop when tried all configurations
-      if idx == nNodes and config[config:size(1)] == 1 then
-         break
+----------------------------------------------------------------------
+-- exact decoding with a junction tree (max-product): falls back to bp
+-- when the clique tables would hold more than graph.maxTableSize entries
+--
+function gm.decode.jtree(graph,maxIter)
+   -- check args
+   if not graph.nodePot or not (graph.edgePot or graph.compactPot) then
+      xlua.error('missing nodePot/edgePot, please call graph:setFactors(...)','decode')
+   end
+
+   -- triangulate, and check the size of the clique tables
+   local cost,width = graph:junctionTree()
+   if cost > graph.maxTableSize then
+      if graph.verbose then
+         warning('<gm.decode.jtree> clique tables too large ('..cost..' entries, treewidth '..width..'), using bp')
       end
+      return gm.decode.bp(graph,maxIter)
    end
 
+   -- verbose
+   if graph.verbose then
+      print('<gm.decode.jtree> decoding on a junction tree (treewidth '..width..')')
+   end
+
+   -- max-product up the tree, and backtracking
+   local optimalconfig = graph.nodePot.new(graph.nNodes)
+   optimalconfig.gm.jtreeDecode(graph.jtree.tree,graph.nodePot,graph:getEdgePot(),optimalconfig,
+                                graph.edgeEnds,graph.nStates)
+
    -- store and return optimal config
    graph.optimal = optimalconfig
    return optimalconfig
@@ -109,10 +129,14 @@ end
 --
 function gm.decode.bp(graph,maxIter)
    -- check args
-   if not graph.nodePot or not graph.edgePot then
+   if not graph.nodePot or not (graph.edgePot or graph.compactPot) then
       xlua.error('missing nodePot/edgePot, please call graph:setFactors(...)','decode')
    end
    maxIter = maxIter or graph.maxIter or 1
+   local beam = graph.beam and (graph.beam > 0 or graph.beamThreshold > 0)
+   if beam and graph.storage and graph.storage ~= 'full' then
+      xlua.error('beam bp needs full storage, not '..graph.storage,'decode')
+   end
 
    -- verbose
    if graph.verbose then
@@ -131,37 +155,73 @@ function gm.decode.bp(graph,maxIter)
    local nodePot = graph.nodePot
    local edgePot = graph.edgePot
 
+   -- renumbered graph: run on reordered copies of the potentials
+   local order = graph.order
+   if order then
+      nodePot = nodePot:index(1,order.node)
+      if edgePot then
+         edgePot = edgePot:index(1,order.edge)
+      end
+      edgeEnds,V,E,nStates = order.edgeEnds,order.V,order.E,order.nStates
+   end
+
    -- init
-   local product = ones(nNodes,maxStates)
    local nodeBel = ones(nNodes,maxStates)
-   local nodeBel_old = nodeBel:clone()
-   local msg = zeros(nEdges*2,maxStates)
-   local msg_old = zeros(nEdges*2,maxStates)
-
-   -- propagate state normalizations
-   msg.gm.bpInitMessages(edgeEnds,nStates,msg)
-
-   -- do loopy belief propagation (if maxIter = 1, it's regular bp)
-   local idx
-   for i = 1,maxIter do
-      idx = i
-      -- pass messages, for all nodes (true = max of products)
-      msg.gm.bpComputeMessages(nodePot,edgePot,edgeEnds,nStates,E,V,msg,true)
-
-      -- check convergence
-      if (msg-msg_old):abs():sum() < 1e-4 then break end
-      msg_old:copy(msg)
-   end
-   if graph.verbose then
-      if idx == maxIter then
-         warning('<gm.decode.bp> reached max iterations ('..maxIter..') before convergence')
-      else
-         print('<gm.decode.bp> decoded graph in '..idx..' iterations')
+
+   if graph.storage and graph.storage ~= 'full' then
+      -- compact storage: the whole message passing runs natively on the
+      -- potentials encoded by graph:setPotentials()
+      local pot = graph.compactPot
+                  or edgePot.gm.compactPotentials(edgePot,edgeEnds,nStates,graph.storage)
+      local idx = nodeBel.gm.bpDecodeCompact(pot,nodePot,nodeBel,edgeEnds,nStates,E,V,
+                                             maxIter,graph.halfMessages)
+      if graph.verbose then
+         print('<gm.decode.bp> decoded graph in '..idx..' iterations ('..graph.storage..' storage)')
+      end
+   elseif beam then
+      -- beam: sparse messages, restricted to their largest states
+      local idx
+      idx,graph.droppedMass = nodeBel.gm.bpDecodeBeam(nodePot,edgePot,nodeBel,edgeEnds,nStates,E,V,
+                                                      maxIter,graph.beam,graph.beamThreshold)
+      if graph.verbose then
+         print('<gm.decode.bp> decoded graph in '..idx..' iterations (beam, dropped mass '..graph.droppedMass..')')
+      end
+   else
+      local product = ones(nNodes,maxStates)
+      local nodeBel_old = nodeBel:clone()
+      local msg = zeros(nEdges*2,maxStates)
+      local msg_old = zeros(nEdges*2,maxStates)
+
+      -- propagate state normalizations
+      msg.gm.bpInitMessages(edgeEnds,nStates,msg)
+
+      -- do loopy belief propagation (if maxIter = 1, it's regular bp)
+      local idx
+      for i = 1,maxIter do
+         idx = i
+         -- pass messages, for all nodes (true = max of products)
+         msg.gm.bpComputeMessages(nodePot,edgePot,edgeEnds,nStates,E,V,msg,true)
+
+         -- check convergence
+         if (msg-msg_old):abs():sum() < 1e-4 then break end
+         msg_old:copy(msg)
       end
+      if graph.verbose then
+         if idx == maxIter then
+            warning('<gm.decode.bp> reached max iterations ('..maxIter..') before convergence')
+         else
+            print('<gm.decode.bp> decoded graph in '..idx..' iterations')
+         end
+      end
+
+      -- compute marginal node beliefs
+      msg.gm.bpComputeNodeBeliefs(nodePot,nodeBel,edgeEnds,nStates,E,V,product,msg)
    end
 
-   -- compute marginal node beliefs
-   msg.gm.bpComputeNodeBeliefs(nodePot,nodeBel,edgeEnds,nStates,E,V,product,msg)
+   -- back to the user's node order
+   if order then
+      nodeBel = nodeBel.new(nodeBel:size()):indexCopy(1,order.node,nodeBel)
+   end
 
    -- get argmax of nodeBel: that's the optimal config
    local pot, optimalconfig = nodeBel:max(2)
@@ -49,6 +49,14 @@ local warning = function(msg)
    print(sys.COLORS.red .. msg .. sys.COLORS.none)
 end
 
+-- CRF edge features are a tensor, or the name of a recipe (bias |
+-- absdiff | concat) that the kernels use to generate them from the node
+-- features, edge by edge, so Xedge is never materialized
+local function instanceEdgeFeatures(Xedge,i)
+   if type(Xedge) == 'string' then return Xedge end
+   return Xedge[i]
+end
+
 ----------------------------------------------------------------------
 -- Negative log-likelihood of a CRF
 --
@@ -56,7 +64,9 @@ function gm.energies.crf.nll(graph,w,nodeMap,edgeMap,inferMethod,maxIter,Y,Xnode
    -- check sizes
    if Xnode:nDimension() == 2 then -- single example
       Xnode = Xnode:reshape(1,Xnode:size(1),Xnode:size(2))
-      Xedge = Xedge:reshape(1,Xedge:size(1),Xedge:size(2))
+      if type(Xedge) ~= 'string' then
+         Xedge = Xedge:reshape(1,Xedge:size(1),Xedge:size(2))
+      end
       Y = Y:reshape(1,Y:size(1))
    end
 
@@ -66,7 +76,6 @@ function gm.energies.crf.nll(graph,w,nodeMap,edgeMap,inferMethod,maxIter,Y,Xnode
    local nNodes = graph.nNodes
    local maxStates = nodeMap:size(2)
    local nNodeFeatures = Xnode:size(2)
-   local nEdgeFeatures = Xedge:size(2)
    local nEdges = graph.nEdges
    local nStates = graph.nStates
    local edgeEnds = graph.edgeEnds
@@ -83,7 +92,8 @@ function gm.energies.crf.nll(graph,w,nodeMap,edgeMap,inferMethod,maxIter,Y,Xnode
    -- compute E=nll and dE/dw
    for i = 1,nInstances do
       -- make potentials
-      gm.energies.crf.makePotentials(graph,w,nodeMap,edgeMap,Xnode[i],Xedge[i])
+      local xedge = instanceEdgeFeatures(Xedge,i)
+      gm.energies.crf.makePotentials(graph,w,nodeMap,edgeMap,Xnode[i],xedge)
 
       -- perform inference
       local nodeBel,edgeBel,logZ = graph:infer(inferMethod,maxIter)
@@ -95,7 +105,7 @@ function gm.energies.crf.nll(graph,w,nodeMap,edgeMap,inferMethod,maxIter,Y,Xnode
       grad.gm.crfGradWrtNodes(Xnode[i],nodeMap,w,nStates,Y[i],nodeBel,grad)
 
       -- compute gradients wrt edges
-      grad.gm.crfGradWrtEdges(Xedge[i],edgeMap,w,edgeEnds,nStates,Y[i],edgeBel,grad)
+      grad.gm.crfGradWrtEdges(xedge,edgeMap,w,edgeEnds,nStates,Y[i],edgeBel,grad,Xnode[i])
    end
 
    -- return nll and grad
@@ -178,6 +188,159 @@ function gm.energies.mrf.nll(graph,w,nodeMap,edgeMap,inferMethod,maxIter,Y)
    return nll,grad
 end
 
+----------------------------------------------------------------------
+-- Local objectives (pseudo-likelihood, piecewise likelihood) of a
+-- CRF: they only need local normalizations, so no inference is run,
+-- and all instances are processed in parallel
+--
+local function crfLocalNll(kernel,graph,w,nodeMap,edgeMap,Y,Xnode,Xedge)
+   -- check sizes
+   if Xnode:nDimension() == 2 then -- single example
+      Xnode = Xnode:reshape(1,Xnode:size(1),Xnode:size(2))
+      if type(Xedge) ~= 'string' then
+         Xedge = Xedge:reshape(1,Xedge:size(1),Xedge:size(2))
+      end
+      Y = Y:reshape(1,Y:size(1))
+   end
+
+   -- compute E=nll and dE/dw
+   local grad = zeros(w:size())
+   local nll = grad.gm[kernel](Xnode,Xedge,nodeMap,edgeMap,w,
+                               graph.edgeEnds,graph.nStates,graph.E,graph.V,
+                               Y,grad)
+
+   -- return nll and grad
+   return nll,grad
+end
+
+-- each node conditioned on the true labels of its neighbours
+function gm.energies.crf.pseudo(graph,w,nodeMap,edgeMap,inferMethod,maxIter,Y,Xnode,Xedge)
+   if graph.verbose then
+      print('<gm.energies.crf.pseudo> computing negative pseudo-likelihood')
+   end
+   return crfLocalNll('crfPseudoNll',graph,w,nodeMap,edgeMap,Y,Xnode,Xedge)
+end
+
+-- each node and edge potential normalized independently
+function gm.energies.crf.piecewise(graph,w,nodeMap,edgeMap,inferMethod,maxIter,Y,Xnode,Xedge)
+   if graph.verbose then
+      print('<gm.energies.crf.piecewise> computing negative piecewise likelihood')
+   end
+   return crfLocalNll('crfPiecewiseNll',graph,w,nodeMap,edgeMap,Y,Xnode,Xedge)
+end
+
+----------------------------------------------------------------------
+-- Local objectives of an MRF: an MRF is a CRF with a single constant
+-- feature per node and edge
+--
+local function mrfLocalNll(kernel,graph,w,nodeMap,edgeMap,Y)
+   local nInstances = Y:size(1)
+   local maxStates = nodeMap:size(2)
+   local nodeMap = nodeMap:reshape(graph.nNodes,maxStates,1)
+   local edgeMap = edgeMap:reshape(graph.nEdges,maxStates,maxStates,1)
+   local Xnode = ones(nInstances,1,graph.nNodes)
+   local Xedge = ones(nInstances,1,graph.nEdges)
+   return crfLocalNll(kernel,graph,w,nodeMap,edgeMap,Y,Xnode,Xedge)
+end
+
+function gm.energies.mrf.pseudo(graph,w,nodeMap,edgeMap,inferMethod,maxIter,Y)
+   if graph.verbose then
+      print('<gm.energies.mrf.pseudo> computing negative pseudo-likelihood')
+   end
+   return mrfLocalNll('crfPseudoNll',graph,w,nodeMap,edgeMap,Y)
+end
+
+function gm.energies.mrf.piecewise(graph,w,nodeMap,edgeMap,inferMethod,maxIter,Y)
+   if graph.verbose then
+      print('<gm.energies.mrf.piecewise> computing negative piecewise likelihood')
+   end
+   return mrfLocalNll('crfPiecewiseNll',graph,w,nodeMap,edgeMap,Y)
+end
+
+----------------------------------------------------------------------
+-- Max-margin (structured SVM) objective: the Hamming loss is added to
+-- the node potentials, each instance is decoded, and the subgradient is
+-- the difference of feature counts between the decoded and true
+-- labelings. bp and jtree decoding run natively, in parallel over
+-- instances; any other gm.decode method is called once per instance
+--
+local function crfMargin(graph,w,nodeMap,edgeMap,maxIter,Y,Xnode,Xedge)
+   -- check sizes
+   if Xnode:nDimension() == 2 then -- single example
+      Xnode = Xnode:reshape(1,Xnode:size(1),Xnode:size(2))
+      if type(Xedge) ~= 'string' then
+         Xedge = Xedge:reshape(1,Xedge:size(1),Xedge:size(2))
+      end
+      Y = Y:reshape(1,Y:size(1))
+   end
+
+   -- locals
+   local nInstances = Y:size(1)
+   local nNodes = graph.nNodes
+   local maxStates = nodeMap:size(2)
+   local decoder = graph.marginDecoder or 'bp'
+   local native = (decoder == 'bp' or decoder == 'jtree')
+                  and (not graph.storage or graph.storage == 'full')
+
+   -- exact decoding needs a junction tree of reasonable size
+   local tree
+   if native and decoder == 'jtree' then
+      local cost,width = graph:junctionTree()
+      if cost > graph.maxTableSize then
+         if graph.verbose then
+            warning('<gm.energies.margin> clique tables too large ('..cost..' entries, treewidth '..width..'), using bp')
+         end
+      else
+         tree = graph.jtree.tree
+      end
+   end
+
+   -- loss-augmented decoding
+   local Yhat = zeros(Y:size())
+   if native then
+      Yhat.gm.crfMarginDecode(Xnode,Xedge,nodeMap,edgeMap,w,
+                              graph.edgeEnds,graph.nStates,graph.E,graph.V,
+                              Y,maxIter,Yhat,tree)
+   else
+      local loss = zeros(nNodes,maxStates)
+      for i = 1,nInstances do
+         gm.energies.crf.makePotentials(graph,w,nodeMap,edgeMap,Xnode[i],instanceEdgeFeatures(Xedge,i))
+         loss:fill(math.exp(1)):scatter(2,Y[i]:long():reshape(nNodes,1),1)
+         graph.nodePot:cmul(loss)
+         Yhat[i]:copy(graph:decode(decoder,maxIter))
+      end
+   end
+
+   -- hinge loss and subgradient
+   local grad = zeros(w:size())
+   local f = grad.gm.crfMarginLoss(Xnode,Xedge,nodeMap,edgeMap,w,
+                                   graph.edgeEnds,graph.nStates,Y,Yhat,grad)
+
+   -- return loss and subgradient
+   return f,grad
+end
+
+function gm.energies.crf.margin(graph,w,nodeMap,edgeMap,inferMethod,maxIter,Y,Xnode,Xedge)
+   if graph.verbose then
+      print('<gm.energies.crf.margin> computing max-margin loss')
+   end
+   return crfMargin(graph,w,nodeMap,edgeMap,maxIter,Y,Xnode,Xedge)
+end
+
+-- an MRF is a CRF with a single constant feature per node and edge
+function gm.energies.mrf.margin(graph,w,nodeMap,edgeMap,inferMethod,maxIter,Y)
+   if graph.verbose then
+      print('<gm.energies.mrf.margin> computing max-margin loss')
+   end
+   local nInstances = Y:size(1)
+   local maxStates = nodeMap:size(2)
+   local nodeMap = nodeMap:reshape(graph.nNodes,maxStates,1)
+   local edgeMap = edgeMap:reshape(graph.nEdges,maxStates,maxStates,1)
+   local Xnode = ones(nInstances,1,graph.nNodes)
+   local Xedge = ones(nInstances,1,graph.nEdges)
+   return crfMargin(graph,w,nodeMap,edgeMap,maxIter,Y,Xnode,Xedge)
+end
+
 ----------------------------------------------------------------------
 -- Make potentials for a CRF
 --
@@ -187,7 +350,6 @@ function gm.energies.crf.makePotentials(graph,w,nodeMap,edgeMap,Xnode,Xedge)
    local nNodes = graph.nNodes
    local maxStates = nodeMap:size(2)
    local nNodeFeatures = Xnode:size(1)
-   local nEdgeFeatures = Xedge:size(1)
    local nEdges = graph.nEdges
    local nStates = graph.nStates
    local edgeEnds = graph.edgeEnds
@@ -205,7 +367,7 @@ function gm.energies.crf.makePotentials(graph,w,nodeMap,edgeMap,Xnode,Xedge)
    -- generate edge potentials
    local edgePot = graph.edgePot or Tensor()
    edgePot:resize(nEdges,maxStates,maxStates)
-   nodePot.gm.crfMakeEdgePotentials(Xedge,edgeMap,w,edgeEnds,nStates,edgePot)
+   nodePot.gm.crfMakeEdgePotentials(Xedge,edgeMap,w,edgeEnds,nStates,edgePot,Xnode)
 
    -- store potentials
    graph:setPotentials(nodePot,edgePot)
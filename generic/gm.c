@@ -7,10 +7,23 @@ static inline THTensor * torch_(Tensor)(lua_State *L, long idx, bool contiguous)
   return THTensor_(newContiguous)(t);
 }
 
+// wraps the topology tensors of a gm.graph (E and V are optional)
+static inline gm::Graph<real> gm_(graph)(THTensor *ee, THTensor *ns, THTensor *EE, THTensor *VV, long maxStates) {
+  gm::Graph<real> graph;
+  graph.nNodes = ns->size[0];
+  graph.nEdges = ee->size[0];
+  graph.maxStates = maxStates;
+  graph.nStates = THTensor_(data)(ns);
+  graph.edgeEnds = THTensor_(data)(ee);
+  graph.E = EE ? THTensor_(data)(EE) : NULL;
+  graph.V = VV ? THTensor_(data)(VV) : NULL;
+  return graph;
+}
+
 static int gm_(maxproduct)(lua_State *L) {
   // get args
-  THTensor *matrix = (THTensor *)luaT_checkudata(L, 1, torch_Tensor);
-  THTensor *vector = (THTensor *)luaT_checkudata(L, 2, torch_Tensor);
+  THTensor *matrix = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 1, torch_Tensor));
+  THTensor *vector = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 2, torch_Tensor));
 
   // dims
   long rows = matrix->size[0];
@@ -18,26 +31,10 @@ static int gm_(maxproduct)(lua_State *L) {
 
   // alloc output
   THTensor *result = THTensor_(newWithSize1d)(rows);
-  THTensor_(zero)(result);
-
-  // get contiguous tensors
-  matrix = THTensor_(newContiguous)(matrix);
-  vector = THTensor_(newContiguous)(vector);
-
-  // raw pointers
-  real *matrix_d = THTensor_(data)(matrix);
-  real *vector_d = THTensor_(data)(vector);
-  real *result_d = THTensor_(data)(result);
 
   // matrix vector max product
-  for (long i = 0; i < rows; i++) {
-    for (long j = 0; j < cols; j++) {
-      real product = matrix_d[i*cols + j] * vector_d[j];
-      if (product > result_d[i]) {
-        result_d[i] = product;
-      }
-    }
-  }
+  gm::maxProduct<real>(THTensor_(data)(matrix), rows, cols,
+                       THTensor_(data)(vector), THTensor_(data)(result));
 
   // clean up
   THTensor_(free)(matrix);
@@ -55,30 +52,11 @@ static int gm_(getPotentialForConfig)(lua_State *L) {
   THTensor *ee = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 3, torch_Tensor));
   THTensor *yy = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 4, torch_Tensor));
 
-  // dims
-  long nNodes = np->size[0];
-  long nEdges = ep->size[0];
-
-  // raw pointers
-  real *nodePot = THTensor_(data)(np);
-  real *edgePot = THTensor_(data)(ep);
-  real *edgeEnds = THTensor_(data)(ee);
-  real *Y = THTensor_(data)(yy);
+  // graph (only edge ends are needed)
+  gm::Graph<real> graph = {np->size[0], ep->size[0], np->size[1], NULL, THTensor_(data)(ee), NULL, NULL};
 
   // potential
-  real pot = 1;
-
-  // node potentials
-  for (long n = 0; n < nNodes; n++) {
-    pot *= nodePot[n*np->stride[0]+(long)(Y[n]-1)];
-  }
-
-  // edge potentials
-  for (long e = 0; e < nEdges; e++) {
-    long n1 = edgeEnds[e*2+0]-1;
-    long n2 = edgeEnds[e*2+1]-1;
-    pot *= edgePot[e*ep->stride[0]+(long)(Y[n1]-1)*ep->stride[1]+(long)(Y[n2]-1)];
-  }
+  real pot = gm::potentialForConfig<real>(graph, THTensor_(data)(np), THTensor_(data)(ep), THTensor_(data)(yy));
 
   // cleanup
   THTensor_(free)(np);
@@ -98,46 +76,120 @@ static int gm_(getLogPotentialForConfig)(lua_State *L) {
   THTensor *ee = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 3, torch_Tensor));
   THTensor *yy = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 4, torch_Tensor));
 
-  // dims
-  long nNodes = np->size[0];
-  long nEdges = ep->size[0];
-
-  // raw pointers
-  real *nodePot = THTensor_(data)(np);
-  real *edgePot = THTensor_(data)(ep);
-  real *edgeEnds = THTensor_(data)(ee);
-  real *Y = THTensor_(data)(yy);
+  // graph (only edge ends are needed)
+  gm::Graph<real> graph = {np->size[0], ep->size[0], np->size[1], NULL, THTensor_(data)(ee), NULL, NULL};
 
   // potential
-  accreal logpot = 0;
+  accreal logpot = gm::logPotentialForConfig<real>(graph, THTensor_(data)(np), THTensor_(data)(ep), THTensor_(data)(yy));
 
-  // node potentials
-  for (long n = 0; n < nNodes; n++) {
-    logpot += log(nodePot[n*np->stride[0]+(long)(Y[n]-1)]);
-  }
+  // cleanup
+  THTensor_(free)(np);
+  THTensor_(free)(ep);
+  THTensor_(free)(ee);
+  THTensor_(free)(yy);
+
+  // return potential
+  lua_pushnumber(L,logpot);
+  return 1;
+}
 
-  // edge potentials
-  for (long e = 0; e < nEdges; e++) {
-    long n1 = edgeEnds[e*2+0]-1;
-    long n2 = edgeEnds[e*2+1]-1;
-    logpot += log(edgePot[e*ep->stride[0]+(long)(Y[n1]-1)*ep->stride[1]+(long)(Y[n2]-1)]);
+static int gm_(getLogPotentialsForConfigs)(lua_State *L) {
+  // args
+  THTensor *np = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 1, torch_Tensor));
+  THTensor *ep = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 2, torch_Tensor));
+  THTensor *ee = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 3, torch_Tensor));
+  THTensor *yy = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 4, torch_Tensor));
+  THArgCheck(yy->nDimension == 2 && yy->size[1] == np->size[0], 4, "configs must be K x nNodes");
+  long nConfigs = yy->size[0];
+  THTensor *nt = NULL, *et = NULL;
+  if (!lua_isnoneornil(L, 5)) {
+    nt = (THTensor *)luaT_checkudata(L, 5, torch_Tensor);
+    et = (THTensor *)luaT_checkudata(L, 6, torch_Tensor);
+    THArgCheck(THTensor_(isContiguous)(nt) && THTensor_(nElement)(nt) == nConfigs*np->size[0], 5,
+               "node terms must be a contiguous K x nNodes tensor");
+    THArgCheck(THTensor_(isContiguous)(et) && THTensor_(nElement)(et) == nConfigs*ep->size[0], 6,
+               "edge terms must be a contiguous K x nEdges tensor");
   }
 
+  // graph (only edge ends are needed)
+  gm::Graph<real> graph = {np->size[0], ep->size[0], np->size[1], NULL, THTensor_(data)(ee), NULL, NULL};
+
+  // log-potentials, and per node/edge terms
+  THTensor *result = THTensor_(newWithSize1d)(nConfigs);
+  gm::logPotentialsForConfigs<real>(graph, THTensor_(data)(np), THTensor_(data)(ep), nConfigs,
+                                    THTensor_(data)(yy), THTensor_(data)(result),
+                                    nt ? THTensor_(data)(nt) : NULL, et ? THTensor_(data)(et) : NULL);
+
   // cleanup
   THTensor_(free)(np);
   THTensor_(free)(ep);
   THTensor_(free)(ee);
   THTensor_(free)(yy);
 
-  // return potential
-  lua_pushnumber(L,logpot);
+  // return log-potentials
+  luaT_pushudata(L, result, torch_Tensor);
   return 1;
 }
 
+static int gm_(orderGraph)(lua_State *L) {
+  // args
+  THTensor *ee = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 1, torch_Tensor));
+  THTensor *ns = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 2, torch_Tensor));
+  const char *name = luaL_checkstring(L, 3);
+  int ordering = 0;
+  if (strcmp(name, "bfs") == 0) ordering = gm::kOrderBFS;
+  else if (strcmp(name, "rcm") == 0) ordering = gm::kOrderRCM;
+  THArgCheck(ordering != 0, 3, "ordering must be one of: bfs | rcm");
+
+  // renumber
+  gm::Graph<real> graph = gm_(graph)(ee, ns, NULL, NULL, 0);
+  std::vector<long> nodeOrder(graph.nNodes+1), edgeOrder(graph.nEdges+1);
+  gm::GraphStorage<real> storage;
+  gm::orderGraph<real>(graph, ordering, &nodeOrder[0], &edgeOrder[0], storage);
+
+  // alloc outputs: orders, then renumbered topology
+  THTensor *no = THTensor_(newWithSize1d)(graph.nNodes);
+  THTensor *eo = THTensor_(newWithSize1d)(graph.nEdges);
+  THTensor *ends = THTensor_(newWithSize2d)(graph.nEdges, 2);
+  THTensor *VV = THTensor_(newWithSize1d)(graph.nNodes+1);
+  THTensor *EE = THTensor_(newWithSize1d)(graph.nEdges*2);
+  THTensor *states = THTensor_(newWithSize1d)(graph.nNodes);
+  real *out_no = THTensor_(data)(no), *out_states = THTensor_(data)(states), *out_VV = THTensor_(data)(VV);
+  real *out_eo = THTensor_(data)(eo), *out_ends = THTensor_(data)(ends), *out_EE = THTensor_(data)(EE);
+  for (long n = 0; n < graph.nNodes; n++) {
+    out_no[n] = nodeOrder[n];
+    out_states[n] = storage.nStates[n];
+    out_VV[n] = storage.V[n];
+  }
+  out_VV[graph.nNodes] = storage.V[graph.nNodes];
+  for (long e = 0; e < graph.nEdges; e++) {
+    out_eo[e] = edgeOrder[e];
+    out_ends[e*2+0] = storage.edgeEnds[e*2+0];
+    out_ends[e*2+1] = storage.edgeEnds[e*2+1];
+    out_EE[e*2+0] = storage.E[e*2+0];
+    out_EE[e*2+1] = storage.E[e*2+1];
+  }
+
+  // cleanup
+  THTensor_(free)(ee);
+  THTensor_(free)(ns);
+
+  // return node order, edge order, and edgeEnds, V, E, nStates
+  luaT_pushudata(L, no, torch_Tensor);
+  luaT_pushudata(L, eo, torch_Tensor);
+  luaT_pushudata(L, ends, torch_Tensor);
+  luaT_pushudata(L, VV, torch_Tensor);
+  luaT_pushudata(L, EE, torch_Tensor);
+  luaT_pushudata(L, states, torch_Tensor);
+  return 6;
+}
+
 static const struct luaL_Reg gm_(methods__) [] = {
   {"maxproduct", gm_(maxproduct)},
   {"getPotentialForConfig", gm_(getPotentialForConfig)},
   {"getLogPotentialForConfig", gm_(getLogPotentialForConfig)},
+  {"getLogPotentialsForConfigs", gm_(getLogPotentialsForConfigs)},
+  {"orderGraph", gm_(orderGraph)},
   {NULL, NULL}
 };
 
@@ -0,0 +1,186 @@
+#ifndef TH_GENERIC_FILE
+#define TH_GENERIC_FILE "generic/gm_dataset.c"
+#else
+
+// zero-copy view of the dataset mapping, which it keeps alive
+static THTensor * gm_dataset_(view)(gm::Dataset *ds, long offset, int nDimension,
+                                    long size0, long size1, long size2) {
+  ds->retain();
+  THStorage *storage = THStorage_(newWithDataAndAllocator)((real *)(ds->data() + offset),
+                                                            size0*size1*size2,
+                                                            &gm_datasetAllocator, ds);
+  THTensor *view;
+  if (nDimension == 1) {
+    view = THTensor_(newWithStorage1d)(storage, 0, size0, 1);
+  } else if (nDimension == 2) {
+    view = THTensor_(newWithStorage2d)(storage, 0, size0, size1, size1, 1);
+  } else {
+    view = THTensor_(newWithStorage3d)(storage, 0, size0, size1*size2, size1, size2, size2, 1);
+  }
+  THStorage_(free)(storage);
+  return view;
+}
+
+static int gm_dataset_(datasetOpen)(lua_State *L) {
+  // get args
+  const char *filename = luaL_checkstring(L, 1);
+
+  // map dataset
+  gm::Dataset *ds = new gm::Dataset();
+  if (!ds->open(filename)) {
+    char err[512];
+    snprintf(err, sizeof(err), "%s", ds->error());
+    ds->release();
+    THError("%s", err);
+  }
+  const gm::DatasetHeader &h = ds->info();
+  if (h.realSize != sizeof(real)) {
+    ds->release();
+    THError("dataset stores %d-byte reals, open it with a matching tensor type", (int)h.realSize);
+  }
+
+  // return dataset and its dims
+  luaT_pushudata(L, ds, "gm.Dataset");
+  lua_pushnumber(L, h.nInstances);
+  lua_pushnumber(L, h.nNodes);
+  lua_pushnumber(L, h.nEdges);
+  lua_pushnumber(L, h.nNodeFeatures);
+  lua_pushnumber(L, h.nEdgeFeatures);
+  lua_pushboolean(L, h.flags & gm::kDatasetTopology);
+  return 7;
+}
+
+static int gm_dataset_(datasetInstance)(lua_State *L) {
+  // get args
+  gm::Dataset *ds = (gm::Dataset *)luaT_checkudata(L, 1, "gm.Dataset");
+  long i = luaL_checknumber(L, 2) - 1;
+  const gm::DatasetHeader &h = ds->info();
+  THArgCheck(i >= 0 && i < h.nInstances, 2, "instance out of range");
+
+  // views
+  gm::DatasetInstance inst = ds->instance(i);
+  luaT_pushudata(L, gm_dataset_(view)(ds, inst.y, 1, inst.nNodes, 1, 1), torch_Tensor);
+  luaT_pushudata(L, gm_dataset_(view)(ds, inst.Xnode, 2, h.nNodeFeatures, inst.nNodes, 1), torch_Tensor);
+  luaT_pushudata(L, gm_dataset_(view)(ds, inst.Xedge, 2, h.nEdgeFeatures, inst.nEdges, 1), torch_Tensor);
+  if (inst.edgeEnds == 0) return 3;
+  luaT_pushudata(L, gm_dataset_(view)(ds, inst.edgeEnds, 2, inst.nEdges, 2, 1), torch_Tensor);
+  return 4;
+}
+
+static int gm_dataset_(datasetBatch)(lua_State *L) {
+  // get args
+  gm::Dataset *ds = (gm::Dataset *)luaT_checkudata(L, 1, "gm.Dataset");
+  long first = luaL_checknumber(L, 2) - 1;
+  long count = luaL_checknumber(L, 3);
+  const gm::DatasetHeader &h = ds->info();
+  THArgCheck(!(h.flags & gm::kDatasetTopology), 1, "batches need a shared topology, use instances");
+  THArgCheck(first >= 0 && count > 0 && first+count <= h.nInstances, 3, "batch out of range");
+
+  // views
+  gm::DatasetInstance inst = ds->instance(first);
+  luaT_pushudata(L, gm_dataset_(view)(ds, inst.y, 2, count, h.nNodes, 1), torch_Tensor);
+  luaT_pushudata(L, gm_dataset_(view)(ds, inst.Xnode, 3, count, h.nNodeFeatures, h.nNodes), torch_Tensor);
+  luaT_pushudata(L, gm_dataset_(view)(ds, inst.Xedge, 3, count, h.nEdgeFeatures, h.nEdges), torch_Tensor);
+  return 3;
+}
+
+static int gm_dataset_(datasetPrefetch)(lua_State *L) {
+  // get args
+  gm::Dataset *ds = (gm::Dataset *)luaT_checkudata(L, 1, "gm.Dataset");
+  long first = luaL_checknumber(L, 2) - 1;
+  long count = luaL_checknumber(L, 3);
+
+  // page in, in the background
+  ds->prefetch(first, count);
+  return 0;
+}
+
+static int gm_dataset_(datasetWriterOpen)(lua_State *L) {
+  // get args
+  const char *filename = luaL_checkstring(L, 1);
+  long nInstances = luaL_checknumber(L, 2);
+  long nNodes = luaL_checknumber(L, 3);
+  long nEdges = luaL_checknumber(L, 4);
+  long nNodeFeatures = luaL_checknumber(L, 5);
+  long nEdgeFeatures = luaL_checknumber(L, 6);
+  bool topology = lua_toboolean(L, 7);
+
+  // create file
+  gm::DatasetWriter *writer = new gm::DatasetWriter();
+  if (!writer->open(filename, sizeof(real), nInstances, nNodes, nEdges,
+                    nNodeFeatures, nEdgeFeatures, topology)) {
+    char err[512];
+    snprintf(err, sizeof(err), "%s", writer->error());
+    delete writer;
+    THError("%s", err);
+  }
+  luaT_pushudata(L, writer, "gm.DatasetWriter");
+  return 1;
+}
+
+static int gm_dataset_(datasetWriterAdd)(lua_State *L) {
+  // get args
+  gm::DatasetWriter *writer = (gm::DatasetWriter *)luaT_checkudata(L, 1, "gm.DatasetWriter");
+  THTensor *y = (THTensor *)luaT_checkudata(L, 2, torch_Tensor);
+  THTensor *x = (THTensor *)luaT_checkudata(L, 3, torch_Tensor);
+  THTensor *z = (THTensor *)luaT_checkudata(L, 4, torch_Tensor);
+  THTensor *e = lua_isnoneornil(L, 5) ? NULL : (THTensor *)luaT_checkudata(L, 5, torch_Tensor);
+
+  // check shapes against the header (before copying, so that nothing leaks)
+  const gm::DatasetHeader &h = writer->info();
+  bool topology = (h.flags & gm::kDatasetTopology) != 0;
+  THArgCheck(y->nDimension == 1, 2, "y must be a vector (nNodes)");
+  THArgCheck(x->nDimension == 2 && x->size[0] == h.nNodeFeatures && x->size[1] == y->size[0],
+             3, "Xnode must be (nb of node features) x nNodes");
+  THArgCheck(z->nDimension == 2 && z->size[0] == h.nEdgeFeatures,
+             4, "Xedge must be (nb of edge features) x nEdges");
+  if (topology) {
+    THArgCheck(e != NULL, 5, "edgeEnds is required with per-instance topology");
+    THArgCheck(e->nDimension == 2 && e->size[0] == z->size[1] && e->size[1] == 2,
+               5, "edgeEnds must be nEdges x 2");
+  }
+  THTensor *yy = THTensor_(newContiguous)(y);
+  THTensor *xn = THTensor_(newContiguous)(x);
+  THTensor *xe = THTensor_(newContiguous)(z);
+  THTensor *ee = (topology && e) ? THTensor_(newContiguous)(e) : NULL;
+
+  // append instance
+  long nNodes = yy->size[0];
+  long nEdges = xe->size[1];
+  bool ok = writer->add(THTensor_(data)(yy), THTensor_(data)(xn), THTensor_(data)(xe),
+                        nNodes, nEdges, ee ? THTensor_(data)(ee) : NULL);
+
+  // clean up
+  THTensor_(free)(yy);
+  THTensor_(free)(xn);
+  THTensor_(free)(xe);
+  if (ee) THTensor_(free)(ee);
+  if (!ok) THError("%s", writer->error());
+  return 0;
+}
+
+static int gm_dataset_(datasetWriterClose)(lua_State *L) {
+  gm::DatasetWriter *writer = (gm::DatasetWriter *)luaT_checkudata(L, 1, "gm.DatasetWriter");
+  if (!writer->close()) THError("%s", writer->error());
+  return 0;
+}
+
+static const struct luaL_Reg gm_dataset_(methods__) [] = {
+  {"datasetOpen", gm_dataset_(datasetOpen)},
+  {"datasetInstance", gm_dataset_(datasetInstance)},
+  {"datasetBatch", gm_dataset_(datasetBatch)},
+  {"datasetPrefetch", gm_dataset_(datasetPrefetch)},
+  {"datasetWriterOpen", gm_dataset_(datasetWriterOpen)},
+  {"datasetWriterAdd", gm_dataset_(datasetWriterAdd)},
+  {"datasetWriterClose", gm_dataset_(datasetWriterClose)},
+  {NULL, NULL}
+};
+
+static void gm_dataset_(Init)(lua_State *L)
+{
+  luaT_pushmetatable(L, torch_Tensor);
+  luaT_registeratname(L, gm_dataset_(methods__), "gm");
+  lua_pop(L,1);
+}
+
+#endif
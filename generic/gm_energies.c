@@ -2,247 +2,309 @@
 #define TH_GENERIC_FILE "generic/gm_energies.c"
 #else
 
-#ifdef _OPENMP
-#include "omp.h"
-#endif
+// edge features at arg i: an Xedge tensor, or the name of a recipe that
+// generates them from the node features xn (dim is the feature dimension);
+// *xe is set to the tensor to free, or NULL. The kernels index edgeMap em
+// (arg iem) with the resulting nb of features, so it is checked here.
+static gm::EdgeFeatures<real> gm_energies_(edgeFeatures)(lua_State *L, int i, THTensor *xn,
+                                                         int dim, THTensor *em, int iem,
+                                                         THTensor **xe) {
+  gm::EdgeFeatures<real> features = {0, NULL, 0};
+  *xe = NULL;
+  if (lua_type(L, i) == LUA_TSTRING) {
+    const char *name = luaL_checkstring(L, i);
+    if (strcmp(name, "bias") == 0) features.recipe = gm::kEdgeBias;
+    else if (strcmp(name, "absdiff") == 0) features.recipe = gm::kEdgeAbsDiff;
+    else if (strcmp(name, "concat") == 0) features.recipe = gm::kEdgeConcat;
+    THArgCheck(features.recipe != 0, i, "edge features must be a tensor, or one of: bias | absdiff | concat");
+    THArgCheck(xn != NULL, i, "edge feature recipes need node features");
+    features.X = THTensor_(data)(xn);
+    features.nX = xn->size[dim];
+  } else {
+    *xe = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, i, torch_Tensor));
+    features.X = THTensor_(data)(*xe);
+    features.nX = (*xe)->size[dim];
+  }
+  THArgCheck(em->nDimension == 4 && em->size[3] == gm::edgeFeatureCount(features), iem,
+             "edgeMap must be E x maxStates x maxStates x (nb of edge features)");
+  return features;
+}
+
+// nodeMap nm (arg inm) against the node features xn (dim is the feature
+// dimension)
+static void gm_energies_(checkNodeMap)(THTensor *nm, int inm, THTensor *xn, int dim) {
+  THArgCheck(nm->nDimension == 3 && nm->size[2] == xn->size[dim], inm,
+             "nodeMap must be N x maxStates x (nb of node features)");
+}
 
 static int gm_energies_(crfGradWrtNodes)(lua_State *L) {
   // get args
-  THTensor *xn = (THTensor *)luaT_checkudata(L, 1, torch_Tensor);
-  THTensor *nm = (THTensor *)luaT_checkudata(L, 2, torch_Tensor);
+  THTensor *xn = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 1, torch_Tensor));
+  THTensor *nm = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 2, torch_Tensor));
   THTensor *ns = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 4, torch_Tensor));
   THTensor *yy = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 5, torch_Tensor));
-  THTensor *nb = (THTensor *)luaT_checkudata(L, 6, torch_Tensor);
+  THTensor *nb = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 6, torch_Tensor));
   THTensor *gd = (THTensor *)luaT_checkudata(L, 7, torch_Tensor);
-
-  // dims
-  long nNodes = nm->size[0];
-  long nNodeFeatures= xn->size[0];
-
-  // raw pointers
-  real *Xnode = THTensor_(data)(xn);
-  real *nodeMap = THTensor_(data)(nm);
-  real *nodeBel = THTensor_(data)(nb);
-  real *nStates = THTensor_(data)(ns);
-  real *Y = THTensor_(data)(yy);
-  real *grad = THTensor_(data)(gd);
+  THArgCheck(THTensor_(isContiguous)(gd), 7, "gradient must be contiguous");
+  gm_energies_(checkNodeMap)(nm, 2, xn, 0);
 
   // compute gradients wrt nodes
-  for (long n = 0; n < nNodes; n++) {
-    long label = (long)Y[n]-1;
-    for (long s = 0; s < nStates[n]; s++) {
-      for (long f = 0; f < nNodeFeatures; f++) {
-        long map = nodeMap[n*nm->stride[0]+s*nm->stride[1]+f*nm->stride[2]];
-        if (map > 0) {
-          real obs = (s == label) ? 1 : 0;
-          grad[map-1] += Xnode[f*xn->stride[0]+n*xn->stride[1]] 
-                                * (nodeBel[n*nb->stride[0]+s*nb->stride[1]] - obs);
-        }
-      }
-    }
-  }
+  gm::Graph<real> graph = {nm->size[0], 0, nm->size[1], THTensor_(data)(ns), NULL, NULL, NULL};
+  gm::crfGradWrtNodes<real>(graph, THTensor_(data)(xn), xn->size[0], THTensor_(data)(nm),
+                            THTensor_(data)(yy), THTensor_(data)(nb), THTensor_(data)(gd));
 
   // clean up
+  THTensor_(free)(xn);
+  THTensor_(free)(nm);
   THTensor_(free)(ns);
   THTensor_(free)(yy);
+  THTensor_(free)(nb);
   return 0;
 }
 
 static int gm_energies_(crfGradWrtEdges)(lua_State *L) {
-  // get args
-  THTensor *xe = (THTensor *)luaT_checkudata(L, 1, torch_Tensor);
-  THTensor *em = (THTensor *)luaT_checkudata(L, 2, torch_Tensor);
+  // get args (node features are only needed by edge feature recipes)
+  THTensor *xn = NULL, *xe;
+  if (!lua_isnoneornil(L, 9)) {
+    xn = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 9, torch_Tensor));
+  }
+  THTensor *em = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 2, torch_Tensor));
+  gm::EdgeFeatures<real> features = gm_energies_(edgeFeatures)(L, 1, xn, 0, em, 2, &xe);
   THTensor *ee = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 4, torch_Tensor));
   THTensor *ns = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 5, torch_Tensor));
   THTensor *yy = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 6, torch_Tensor));
-  THTensor *eb = (THTensor *)luaT_checkudata(L, 7, torch_Tensor);
+  THTensor *eb = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 7, torch_Tensor));
   THTensor *gd = (THTensor *)luaT_checkudata(L, 8, torch_Tensor);
-
-  // dims
-  long nEdges = em->size[0];
-  long nEdgeFeatures = xe->size[0];
-
-  // raw pointers
-  real *Xedge = THTensor_(data)(xe);
-  real *edgeMap = THTensor_(data)(em);
-  real *edgeBel = THTensor_(data)(eb);
-  real *nStates = THTensor_(data)(ns);
-  real *edgeEnds = THTensor_(data)(ee);
-  real *Y = THTensor_(data)(yy);
-
-  // partial gradients
-  // :
-#ifdef _OPENMP
-  long maxthreads = omp_get_max_threads();
-#else
-  long maxthreads = 1;
-#endif
-  THTensor **gds = (THTensor **)malloc(sizeof(void*)*maxthreads);
-  real **grads = (real **)malloc(sizeof(void*)*maxthreads);
-  for (int i = 0; i < maxthreads; i++) {
-    gds[i] = THTensor_(newWithSize1d)(gd->size[0]);
-    grads[i] = THTensor_(data)(gds[i]);
-  }
+  THArgCheck(THTensor_(isContiguous)(gd), 8, "gradient must be contiguous");
 
   // compute gradients wrt edges
-#pragma omp parallel
-{
-  // partial gradients
-#ifdef _OPENMP
-  long id = omp_get_thread_num();
-#else
-  long id = 0;
-#endif
-  real *grad = grads[id];
-  THTensor_(zero)(gds[id]);
-
-  // map
-#pragma omp for
-  for (long e = 0; e < nEdges; e++) {
-    long n1 = edgeEnds[e*2+0]-1;
-    long n2 = edgeEnds[e*2+1]-1;
-    long label1 = (long)Y[n1]-1;
-    long label2 = (long)Y[n2]-1;
-    for (long s1 = 0; s1 < nStates[n1]; s1++) {
-      for (long s2 = 0; s2 < nStates[n2]; s2++) {
-        for (long f = 0; f < nEdgeFeatures; f++) {
-          long map = edgeMap[e*em->stride[0]+s1*em->stride[1]+s2*em->stride[2]+f*em->stride[3]];
-          if (map > 0) {
-            real obs = ((s1 == label1) && (s2 == label2)) ? 1 : 0;
-            grad[map-1] += Xedge[f*xe->stride[0]+e*xe->stride[1]] 
-                  * (edgeBel[e*eb->stride[0]+s1*eb->stride[1]+s2*eb->stride[2]] - obs);
-          }
-        }
-      }
-    }
-  }
-
-  // reduce
-#pragma omp barrier
-  if (id==0) {
-#ifdef _OPENMP
-    long nthreads = omp_get_num_threads();
-#else
-    long nthreads = 1;
-#endif
-    for (int i = 0; i < nthreads; i++) {
-      THTensor_(cadd)(gd, gd, 1.0, gds[i]);
-    }
-  }
-}
+  gm::Graph<real> graph = gm_(graph)(ee, ns, NULL, NULL, em->size[1]);
+  gm::crfGradWrtEdges<real>(graph, features, THTensor_(data)(em),
+                            THTensor_(data)(yy), THTensor_(data)(eb),
+                            gd->size[0], THTensor_(data)(gd));
 
   // clean up
-  for (int i = 0; i < maxthreads; i++) {
-    THTensor_(free)(gds[i]);
-  }
-  free(gds);
-  free(grads);
+  if (xn) THTensor_(free)(xn);
+  if (xe) THTensor_(free)(xe);
+  THTensor_(free)(em);
   THTensor_(free)(ee);
   THTensor_(free)(ns);
   THTensor_(free)(yy);
+  THTensor_(free)(eb);
   return 0;
 }
 
 static int gm_energies_(crfMakeNodePotentials)(lua_State *L) {
   // get args
-  THTensor *xn = (THTensor *)luaT_checkudata(L, 1, torch_Tensor);
-  THTensor *nm = (THTensor *)luaT_checkudata(L, 2, torch_Tensor);
+  THTensor *xn = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 1, torch_Tensor));
+  THTensor *nm = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 2, torch_Tensor));
   THTensor *ww = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 3, torch_Tensor));
   THTensor *ns = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 4, torch_Tensor));
   THTensor *np = (THTensor *)luaT_checkudata(L, 5, torch_Tensor);
-
-  // dims
-  long nNodes = nm->size[0];
-  long nNodeFeatures= xn->size[0];
-
-  // zero output
-  THTensor_(zero)(np);
-
-  // raw pointers
-  real *Xnode = THTensor_(data)(xn);
-  real *nodeMap = THTensor_(data)(nm);
-  real *nodePot = THTensor_(data)(np);
-  real *nStates = THTensor_(data)(ns);
-  real *w = THTensor_(data)(ww);
+  THArgCheck(THTensor_(isContiguous)(np), 5, "node potentials must be contiguous");
+  gm_energies_(checkNodeMap)(nm, 2, xn, 0);
 
   // generate node potentials
-#pragma omp parallel for
-  for (long n = 0; n < nNodes; n++) {
-    for (long s = 0; s < nStates[n]; s++) {
-      long np_i = n*np->stride[0]+s*np->stride[1];
-      for (long f = 0; f < nNodeFeatures; f++) {
-        long map = nodeMap[n*nm->stride[0]+s*nm->stride[1]+f*nm->stride[2]];
-        if (map > 0) {
-          nodePot[np_i] += w[map-1]*Xnode[f*xn->stride[0]+n*xn->stride[1]];
-
-        }
-      }
-      nodePot[np_i] = exp(nodePot[np_i]);
-    }
-  }
+  gm::Graph<real> graph = {nm->size[0], 0, np->size[1], THTensor_(data)(ns), NULL, NULL, NULL};
+  gm::crfMakeNodePotentials<real>(graph, THTensor_(data)(xn), xn->size[0], THTensor_(data)(nm),
+                                  THTensor_(data)(ww), THTensor_(data)(np));
 
   // clean up
+  THTensor_(free)(xn);
+  THTensor_(free)(nm);
   THTensor_(free)(ns);
   THTensor_(free)(ww);
   return 0;
 }
 
 static int gm_energies_(crfMakeEdgePotentials)(lua_State *L) {
-  // get args
-  THTensor *xe = (THTensor *)luaT_checkudata(L, 1, torch_Tensor);
-  THTensor *em = (THTensor *)luaT_checkudata(L, 2, torch_Tensor);
+  // get args (node features are only needed by edge feature recipes)
+  THTensor *xn = NULL, *xe;
+  if (!lua_isnoneornil(L, 7)) {
+    xn = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 7, torch_Tensor));
+  }
+  THTensor *em = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 2, torch_Tensor));
+  gm::EdgeFeatures<real> features = gm_energies_(edgeFeatures)(L, 1, xn, 0, em, 2, &xe);
   THTensor *ww = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 3, torch_Tensor));
   THTensor *ee = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 4, torch_Tensor));
   THTensor *ns = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 5, torch_Tensor));
   THTensor *ep = (THTensor *)luaT_checkudata(L, 6, torch_Tensor);
+  THArgCheck(THTensor_(isContiguous)(ep), 6, "edge potentials must be contiguous");
+
+  // generate edge potentials
+  gm::Graph<real> graph = gm_(graph)(ee, ns, NULL, NULL, ep->size[1]);
+  gm::crfMakeEdgePotentials<real>(graph, features, THTensor_(data)(em),
+                                  THTensor_(data)(ww), THTensor_(data)(ep));
 
-  // dims
-  long nEdges = ep->size[0];
-  long nEdgeFeatures = xe->size[0];
+  // clean up
+  if (xn) THTensor_(free)(xn);
+  if (xe) THTensor_(free)(xe);
+  THTensor_(free)(em);
+  THTensor_(free)(ww);
+  THTensor_(free)(ee);
+  THTensor_(free)(ns);
+  return 0;
+}
 
-  // zero output
-  THTensor_(zero)(ep);
+// shared by crfPseudoNll and crfPiecewiseNll
+static int gm_energies_(crfLocalNll)(lua_State *L, bool pseudo) {
+  // get args
+  THTensor *xn = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 1, torch_Tensor));
+  THTensor *nm = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 3, torch_Tensor));
+  THTensor *em = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 4, torch_Tensor));
+  THTensor *xe;
+  gm::EdgeFeatures<real> features = gm_energies_(edgeFeatures)(L, 2, xn, 1, em, 4, &xe);
+  gm_energies_(checkNodeMap)(nm, 3, xn, 1);
+  THTensor *ww = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 5, torch_Tensor));
+  THTensor *ee = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 6, torch_Tensor));
+  THTensor *ns = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 7, torch_Tensor));
+  THTensor *EE = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 8, torch_Tensor));
+  THTensor *VV = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 9, torch_Tensor));
+  THTensor *yy = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 10, torch_Tensor));
+  THTensor *gd = (THTensor *)luaT_checkudata(L, 11, torch_Tensor);
+  THArgCheck(THTensor_(isContiguous)(gd), 11, "gradient must be contiguous");
 
-  // raw pointers
-  real *Xedge = THTensor_(data)(xe);
-  real *edgeMap = THTensor_(data)(em);
-  real *nStates = THTensor_(data)(ns);
-  real *w = THTensor_(data)(ww);
-  real *edgeEnds = THTensor_(data)(ee);
-  real *edgePot = THTensor_(data)(ep);
+  // dims (features are nInstances x F x N and nInstances x F x E)
+  long nInstances = yy->size[0];
+  long nNodeFeatures = xn->size[1];
 
-  // generate edge potentials
-#pragma omp parallel for
-  for (long e = 0; e < nEdges; e++) {
-    long n1 = edgeEnds[e*2+0]-1;
-    long n2 = edgeEnds[e*2+1]-1;
-    for (long s1 = 0; s1 < nStates[n1]; s1++) {
-      for (long s2 = 0; s2 < nStates[n2]; s2++) {
-        long ep_i = e*ep->stride[0]+s1*ep->stride[1]+s2*ep->stride[2];
-        for (long f = 0; f < nEdgeFeatures; f++) {
-          long map = edgeMap[e*em->stride[0]+s1*em->stride[1]+s2*em->stride[2]+f*em->stride[3]];
-          if (map > 0) {
-            real prod = w[map-1]*Xedge[f*xe->stride[0]+e*xe->stride[1]];
-            edgePot[ep_i] += prod;
-          }
-        }
-        edgePot[ep_i] = exp(edgePot[ep_i]);
-      }
-    }
+  // nll and gradient, over all instances
+  gm::Graph<real> graph = gm_(graph)(ee, ns, EE, VV, nm->size[1]);
+  accreal nll;
+  if (pseudo) {
+    nll = gm::crfPseudoNll<real>(graph, THTensor_(data)(ww), gd->size[0],
+                                 THTensor_(data)(nm), THTensor_(data)(em),
+                                 nInstances, THTensor_(data)(yy),
+                                 THTensor_(data)(xn), nNodeFeatures,
+                                 features, THTensor_(data)(gd));
+  } else {
+    nll = gm::crfPiecewiseNll<real>(graph, THTensor_(data)(ww), gd->size[0],
+                                    THTensor_(data)(nm), THTensor_(data)(em),
+                                    nInstances, THTensor_(data)(yy),
+                                    THTensor_(data)(xn), nNodeFeatures,
+                                    features, THTensor_(data)(gd));
+  }
+
+  // clean up
+  THTensor_(free)(xn);
+  if (xe) THTensor_(free)(xe);
+  THTensor_(free)(nm);
+  THTensor_(free)(em);
+  THTensor_(free)(ww);
+  THTensor_(free)(ee);
+  THTensor_(free)(ns);
+  THTensor_(free)(EE);
+  THTensor_(free)(VV);
+  THTensor_(free)(yy);
+
+  // return nll
+  lua_pushnumber(L, nll);
+  return 1;
+}
+
+static int gm_energies_(crfPseudoNll)(lua_State *L) {
+  return gm_energies_(crfLocalNll)(L, true);
+}
+
+static int gm_energies_(crfPiecewiseNll)(lua_State *L) {
+  return gm_energies_(crfLocalNll)(L, false);
+}
+
+static int gm_energies_(crfMarginDecode)(lua_State *L) {
+  // get args
+  THTensor *xn = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 1, torch_Tensor));
+  THTensor *nm = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 3, torch_Tensor));
+  THTensor *em = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 4, torch_Tensor));
+  THTensor *xe;
+  gm::EdgeFeatures<real> features = gm_energies_(edgeFeatures)(L, 2, xn, 1, em, 4, &xe);
+  gm_energies_(checkNodeMap)(nm, 3, xn, 1);
+  THTensor *ww = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 5, torch_Tensor));
+  THTensor *ee = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 6, torch_Tensor));
+  THTensor *ns = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 7, torch_Tensor));
+  THTensor *EE = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 8, torch_Tensor));
+  THTensor *VV = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 9, torch_Tensor));
+  THTensor *yy = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 10, torch_Tensor));
+  long maxIter = luaL_checknumber(L, 11);
+  THTensor *yh = (THTensor *)luaT_checkudata(L, 12, torch_Tensor);
+  THArgCheck(THTensor_(isContiguous)(yh), 12, "decoded labelings must be contiguous");
+  gm::JunctionTree *jt = NULL;
+  if (!lua_isnoneornil(L, 13)) {
+    jt = (gm::JunctionTree *)luaT_checkudata(L, 13, "gm.JunctionTree");
+    THArgCheck(jt->nNodes == ns->size[0], 13, "junction tree doesn't match the graph");
   }
 
+  // loss-augmented decoding of all instances
+  gm::Graph<real> graph = gm_(graph)(ee, ns, EE, VV, nm->size[1]);
+  bool ok = gm::crfMarginDecode<real>(graph, jt, THTensor_(data)(ww),
+                                      THTensor_(data)(nm), THTensor_(data)(em), maxIter,
+                                      yy->size[0], THTensor_(data)(yy),
+                                      THTensor_(data)(xn), xn->size[1],
+                                      features, THTensor_(data)(yh));
+
   // clean up
+  THTensor_(free)(xn);
+  if (xe) THTensor_(free)(xe);
+  THTensor_(free)(nm);
+  THTensor_(free)(em);
   THTensor_(free)(ww);
   THTensor_(free)(ee);
   THTensor_(free)(ns);
+  THTensor_(free)(EE);
+  THTensor_(free)(VV);
+  THTensor_(free)(yy);
+  if (!ok) THError("numeric precision too low, can't decode");
   return 0;
 }
 
+static int gm_energies_(crfMarginLoss)(lua_State *L) {
+  // get args
+  THTensor *xn = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 1, torch_Tensor));
+  THTensor *nm = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 3, torch_Tensor));
+  THTensor *em = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 4, torch_Tensor));
+  THTensor *xe;
+  gm::EdgeFeatures<real> features = gm_energies_(edgeFeatures)(L, 2, xn, 1, em, 4, &xe);
+  gm_energies_(checkNodeMap)(nm, 3, xn, 1);
+  THTensor *ww = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 5, torch_Tensor));
+  THTensor *ee = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 6, torch_Tensor));
+  THTensor *ns = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 7, torch_Tensor));
+  THTensor *yy = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 8, torch_Tensor));
+  THTensor *yh = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 9, torch_Tensor));
+  THTensor *gd = (THTensor *)luaT_checkudata(L, 10, torch_Tensor);
+  THArgCheck(THTensor_(isContiguous)(gd), 10, "gradient must be contiguous");
+
+  // hinge loss and subgradient, over all instances
+  gm::Graph<real> graph = gm_(graph)(ee, ns, NULL, NULL, nm->size[1]);
+  accreal loss = gm::crfMarginLoss<real>(graph, THTensor_(data)(ww), gd->size[0],
+                                         THTensor_(data)(nm), THTensor_(data)(em),
+                                         yy->size[0], THTensor_(data)(yy), THTensor_(data)(yh),
+                                         THTensor_(data)(xn), xn->size[1],
+                                         features, THTensor_(data)(gd));
+
+  // clean up
+  THTensor_(free)(xn);
+  if (xe) THTensor_(free)(xe);
+  THTensor_(free)(nm);
+  THTensor_(free)(em);
+  THTensor_(free)(ww);
+  THTensor_(free)(ee);
+  THTensor_(free)(ns);
+  THTensor_(free)(yy);
+  THTensor_(free)(yh);
+
+  // return loss
+  lua_pushnumber(L, loss);
+  return 1;
+}
+
 static const struct luaL_Reg gm_energies_(methods__) [] = {
   {"crfGradWrtNodes", gm_energies_(crfGradWrtNodes)},
   {"crfGradWrtEdges", gm_energies_(crfGradWrtEdges)},
   {"crfMakeNodePotentials", gm_energies_(crfMakeNodePotentials)},
   {"crfMakeEdgePotentials", gm_energies_(crfMakeEdgePotentials)},
+  {"crfPseudoNll", gm_energies_(crfPseudoNll)},
+  {"crfPiecewiseNll", gm_energies_(crfPiecewiseNll)},
+  {"crfMarginDecode", gm_energies_(crfMarginDecode)},
+  {"crfMarginLoss", gm_energies_(crfMarginLoss)},
   {NULL, NULL}
 };
 
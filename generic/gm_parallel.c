@@ -0,0 +1,137 @@
+#ifndef TH_GENERIC_FILE
+#define TH_GENERIC_FILE "generic/gm_parallel.c"
+#else
+
+static gm::WorkerPool * gm_parallel_(checkPool)(lua_State *L, int idx) {
+  gm::WorkerPool *pool = (gm::WorkerPool *)luaT_checkudata(L, idx, "gm.WorkerPool");
+  THArgCheck(pool->realBytes() == sizeof(real), idx, "pool holds reals of another type");
+  return pool;
+}
+
+static int gm_parallel_(poolCreate)(lua_State *L) {
+  // get args
+  long nWorkers = luaL_checknumber(L, 1);
+  long nParams = luaL_checknumber(L, 2);
+
+  // shared memory for w and the workers' results
+  gm::WorkerPool *pool = new gm::WorkerPool();
+  if (!pool->create(nWorkers, nParams, sizeof(real))) {
+    char err[512];
+    snprintf(err, sizeof(err), "%s", pool->error());
+    delete pool;
+    THError("%s", err);
+  }
+
+  // return pool
+  luaT_pushudata(L, pool, "gm.WorkerPool");
+  return 1;
+}
+
+static int gm_parallel_(poolSpawn)(lua_State *L) {
+  // get args
+  gm::WorkerPool *pool = gm_parallel_(checkPool)(L, 1);
+  bool numa = lua_toboolean(L, 2);
+
+  // fork workers
+  long id = pool->spawn(numa);
+  if (id == -2) THError("%s", pool->error());
+
+  // return worker index (1-based) in workers, 0 in the parent
+  lua_pushnumber(L, id+1);
+  return 1;
+}
+
+static int gm_parallel_(poolStep)(lua_State *L) {
+  // get args
+  gm::WorkerPool *pool = gm_parallel_(checkPool)(L, 1);
+  THTensor *w = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 2, torch_Tensor));
+  long batchSize = luaL_checknumber(L, 3);
+  THTensor *grad = (THTensor *)luaT_checkudata(L, 4, torch_Tensor);
+  THArgCheck(THTensor_(nElement)(w) == pool->params(), 2, "w doesn't match the pool");
+  THArgCheck(THTensor_(isContiguous)(grad) && THTensor_(nElement)(grad) == pool->params(), 4,
+             "gradient must be contiguous, and match the pool");
+
+  // one step on all workers, and reduction
+  double nll = 0;
+  bool ok = pool->step(THTensor_(data)(w), batchSize, &nll);
+  if (ok) gm::reduceGradients<real>(*pool, THTensor_(data)(grad));
+
+  // clean up
+  THTensor_(free)(w);
+  if (!ok) THError("%s", pool->error());
+
+  // return nll
+  lua_pushnumber(L, nll);
+  return 1;
+}
+
+static int gm_parallel_(poolStop)(lua_State *L) {
+  gm::WorkerPool *pool = gm_parallel_(checkPool)(L, 1);
+  pool->stop();
+  return 0;
+}
+
+static int gm_parallel_(poolNext)(lua_State *L) {
+  // get args
+  gm::WorkerPool *pool = gm_parallel_(checkPool)(L, 1);
+  long worker = luaL_checknumber(L, 2) - 1;
+  THArgCheck(worker >= 0 && worker < pool->workers(), 2, "worker index out of range");
+  THTensor *w = (THTensor *)luaT_checkudata(L, 3, torch_Tensor);
+  THArgCheck(THTensor_(isContiguous)(w) && THTensor_(nElement)(w) == pool->params(), 3,
+             "w must be contiguous, and match the pool");
+
+  // wait for the next step
+  long batchSize;
+  if (!pool->next(worker, THTensor_(data)(w), &batchSize)) return 0;
+
+  // return batch size
+  lua_pushnumber(L, batchSize);
+  return 1;
+}
+
+static int gm_parallel_(poolFinish)(lua_State *L) {
+  // get args
+  gm::WorkerPool *pool = gm_parallel_(checkPool)(L, 1);
+  long worker = luaL_checknumber(L, 2) - 1;
+  THArgCheck(worker >= 0 && worker < pool->workers(), 2, "worker index out of range");
+  double nll = luaL_checknumber(L, 3);
+  THTensor *grad = NULL;
+  if (!lua_isnoneornil(L, 4)) {
+    grad = THTensor_(newContiguous)((THTensor *)luaT_checkudata(L, 4, torch_Tensor));
+    THArgCheck(THTensor_(nElement)(grad) == pool->params(), 4, "gradient doesn't match the pool");
+  }
+  const char *error = lua_isnoneornil(L, 5) ? NULL : luaL_checkstring(L, 5);
+
+  // publish results
+  pool->finish(worker, nll, grad ? THTensor_(data)(grad) : NULL, error);
+
+  // clean up
+  if (grad) THTensor_(free)(grad);
+  return 0;
+}
+
+static int gm_parallel_(poolExit)(lua_State *L) {
+  // workers leave without running the parent's exit handlers
+  _exit(0);
+  return 0;
+}
+
+static const struct luaL_Reg gm_parallel_(methods__) [] = {
+  {"poolCreate", gm_parallel_(poolCreate)},
+  {"poolSpawn", gm_parallel_(poolSpawn)},
+  {"poolStep", gm_parallel_(poolStep)},
+  {"poolStop", gm_parallel_(poolStop)},
+  {"poolNext", gm_parallel_(poolNext)},
+  {"poolFinish", gm_parallel_(poolFinish)},
+  {"poolExit", gm_parallel_(poolExit)},
+  {NULL, NULL}
+};
+
+static void gm_parallel_(Init)(lua_State *L)
+{
+  luaT_pushmetatable(L, torch_Tensor);
+  luaT_registeratname(L, gm_parallel_(methods__), "gm");
+  lua_pop(L,1);
+}
+
+#endif
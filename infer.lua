@@ -50,7 +50,7 @@ end
 --
 function gm.infer.exact(graph)
    -- check args
-   if not graph.nodePot or not graph.edgePot then
+   if not graph.nodePot or not (graph.edgePot or graph.compactPot) then
       xlua.error('missing nodePot/edgePot, please call graph:setFactors(...)','infer')
    end
 
@@ -67,56 +67,106 @@ function gm.infer.exact(graph)
    local nStates = graph.nStates
    local edgeEnds = graph.edgeEnds
 
-   -- init
-   local config = ones(nNodes)
-   local nodeBel = zeros(nNodes,maxStates)
-   local edgeBel = zeros(nEdges,maxStates,maxStates)
+   -- init (beliefs accumulate potentials, so they take their type)
+   local nodeBel = graph.nodePot.new(nNodes,maxStates):zero()
+   local edgeBel = graph.nodePot.new(nEdges,maxStates,maxStates):zero()
+   local nConfigs = nStates:prod()
+   local batch = 4096
    local Z = 0
 
-   -- exact inference
-   while true do
-      -- get potential for configuration
-      local pot = graph:getPotentialForConfig(config)
+   -- offsets of each node's and edge's entries in nodeBel and edgeBel
+   local nodeBase = torch.range(0,nNodes-1):mul(maxStates):view(1,nNodes)
+   local edgeBase = torch.range(0,nEdges-1):mul(maxStates*maxStates):view(1,nEdges)
+   local ends1 = edgeEnds:select(2,1):long()
+   local ends2 = edgeEnds:select(2,2):long()
 
-      -- update nodeBel
-      for n = 1,nNodes do
-         nodeBel[n][config[n]] = nodeBel[n][config[n]] + pot
-      end
+   -- exact inference: score all configurations natively, a batch at a
+   -- time, and accumulate exp(logpot - shift) so that nothing underflows
+   local edgePot = graph:getEdgePot()
+   local shift = -math.huge
+   for first = 0,nConfigs-1,batch do
+      local count = math.min(batch,nConfigs-first)
+      local configs = graph:getConfigs(first,count)
+      local logpot = graph:getLogPotentialsForConfigs(configs,false,edgePot)
 
-      -- update edgeBel
-      for e = 1,nEdges do
-         local n1 = edgeEnds[e][1]
-         local n2 = edgeEnds[e][2]
-         edgeBel[e][config[n1]][config[n2]] = edgeBel[e][config[n1]][config[n2]] + pot
+      -- rescale what was accumulated, when the largest potential grows
+      local top = logpot:max()
+      if top > shift then
+         local scale = math.exp(shift-top)
+         nodeBel:mul(scale)
+         edgeBel:mul(scale)
+         Z = Z*scale
+         shift = top
       end
 
-      -- update Z
-      Z = Z + pot
+      if shift > -math.huge then
+         local pot = logpot:add(-shift):exp()
+         local weights = pot:view(count,1)
 
-      -- next config
-      local idx
-      for i = 1,nNodes do
-         idx = i
-         config[i] = config[i] + 1
-         if config[i] <= nStates[i] then
-            break
-         else
-            config[i] = 1
-         end
-      end
+         -- update Z
+         Z = Z + pot:sum()
+
+         -- update nodeBel: entry (n,y[n]) of each configuration
+         local index = (configs-1):add(nodeBase:expand(count,nNodes)):add(1):long()
+         nodeBel:view(-1):indexAdd(1,index:view(-1),weights:expand(count,nNodes):contiguous():view(-1))
 
-      -- stop when tried all configurations
-      if idx == nNodes and config[config:size(1)] == 1 then
-         break
+         -- update edgeBel: entry (e,y[n1],y[n2]) of each configuration
+         index = (configs:index(2,ends1)-1):mul(maxStates):add(configs:index(2,ends2))
+                    :add(edgeBase:expand(count,nEdges)):long()
+         edgeBel:view(-1):indexAdd(1,index:view(-1),weights:expand(count,nEdges):contiguous():view(-1))
       end
    end
 
    -- normalize
    nodeBel:div(Z)
    edgeBel:div(Z)
+   local logZ = shift + log(Z)
 
    -- return marginal beliefs, pairwise beliefs, and negative of free energy
-   return nodeBel, edgeBel, log(Z)
+   return nodeBel, edgeBel, logZ
+end
+
+----------------------------------------------------------------------
+-- exact inference with a junction tree: cost grows with the treewidth
+-- only, which suits ladders, narrow grids, cycles with a few chords...
+-- Falls back to bp when the clique tables would hold more than
+-- graph.maxTableSize entries.
+--
+function gm.infer.jtree(graph,maxIter)
+   -- check args
+   if not graph.nodePot or not (graph.edgePot or graph.compactPot) then
+      xlua.error('missing nodePot/edgePot, please call graph:setFactors(...)','infer')
+   end
+
+   -- triangulate, and check the size of the clique tables
+   local cost,width = graph:junctionTree()
+   if cost > graph.maxTableSize then
+      if graph.verbose then
+         warning('<gm.infer.jtree> clique tables too large ('..cost..' entries, treewidth '..width..'), using bp')
+      end
+      return gm.infer.bp(graph,maxIter)
+   end
+
+   -- verbose
+   if graph.verbose then
+      print('<gm.infer.jtree> doing exact inference on a junction tree (treewidth '..width..')')
+   end
+
+   -- local vars
+   local nNodes = graph.nNodes
+   local maxStates = graph.nodePot:size(2)
+   local nEdges = graph.nEdges
+   local nodePot = graph.nodePot
+   local edgePot = graph:getEdgePot()
+
+   -- two-pass message passing over clique tables
+   local nodeBel = zeros(nNodes,maxStates)
+   local edgeBel = zeros(nEdges,maxStates,maxStates)
+   local logZ = nodeBel.gm.jtreeInfer(graph.jtree.tree,nodePot,edgePot,nodeBel,edgeBel,
+                                      graph.edgeEnds,graph.nStates)
+
+   -- return marginal beliefs, pairwise beliefs, and log partition function
+   return nodeBel, edgeBel, logZ
 end
 
 ----------------------------------------------------------------------
@@ -125,10 +175,14 @@ end
 --
 function gm.infer.bp(graph,maxIter)
    -- check args
-   if not graph.nodePot or not graph.edgePot then
+   if not graph.nodePot or not (graph.edgePot or graph.compactPot) then
       xlua.error('missing nodePot/edgePot, please call graph:setFactors(...)','decode')
    end
    maxIter = maxIter or 1
+   local beam = graph.beam and (graph.beam > 0 or graph.beamThreshold > 0)
+   if beam and graph.storage and graph.storage ~= 'full' then
+      xlua.error('beam bp needs full storage, not '..graph.storage,'infer')
+   end
 
    -- verbose
    if graph.verbose then
@@ -147,44 +201,79 @@ function gm.infer.bp(graph,maxIter)
    local nodePot = graph.nodePot
    local edgePot = graph.edgePot
 
+   -- renumbered graph: run on reordered copies of the potentials
+   local order = graph.order
+   if order then
+      nodePot = nodePot:index(1,order.node)
+      if edgePot then
+         edgePot = edgePot:index(1,order.edge)
+      end
+      edgeEnds,V,E,nStates = order.edgeEnds,order.V,order.E,order.nStates
+   end
+
    -- init
-   local product = ones(nNodes,maxStates)
    local nodeBel = ones(nNodes,maxStates)
    local edgeBel = zeros(nEdges,maxStates,maxStates)
-   local nodeBel_old = nodeBel:clone()
-   local msg = zeros(nEdges*2,maxStates)
-   local msg_old = zeros(nEdges*2,maxStates)
-
-   -- propagate state normalizations
-   msg.gm.bpInitMessages(edgeEnds,nStates,msg)
-
-   -- do loopy belief propagation (if maxIter = 1, it's regular bp)
-   local idx
-   for i = 1,maxIter do
-      idx = i
-      -- pass messages, for all nodes (false = sum of products)
-      msg.gm.bpComputeMessages(nodePot,edgePot,edgeEnds,nStates,E,V,msg,false)
-
-      -- check convergence
-      if (msg-msg_old):abs():sum() < 1e-4 then break end
-      msg_old:copy(msg)
-   end
-   if graph.verbose then
-      if idx == maxIter then
-         warning('<gm.infer.bp> reached max iterations ('..maxIter..') before convergence')
-      else
-         print('<gm.infer.bp> decoded graph in '..idx..' iterations')
+
+   local logZ
+   if graph.storage and graph.storage ~= 'full' then
+      -- compact storage: the whole message passing runs natively on the
+      -- potentials encoded by graph:setPotentials() (compute stays in
+      -- full precision)
+      local pot = graph.compactPot
+                  or edgePot.gm.compactPotentials(edgePot,edgeEnds,nStates,graph.storage)
+      local idx
+      logZ,idx = nodeBel.gm.bpInferCompact(pot,nodePot,nodeBel,edgeBel,edgeEnds,nStates,E,V,
+                                           maxIter,graph.halfMessages)
+      if graph.verbose then
+         print('<gm.infer.bp> inferred graph in '..idx..' iterations ('..graph.storage..' storage)')
       end
-   end
+   elseif beam then
+      -- beam: sparse messages, restricted to their largest states
+      local idx
+      logZ,idx,graph.droppedMass = nodeBel.gm.bpInferBeam(nodePot,edgePot,nodeBel,edgeBel,
+                                                          edgeEnds,nStates,E,V,maxIter,
+                                                          graph.beam,graph.beamThreshold)
+      if graph.verbose then
+         print('<gm.infer.bp> inferred graph in '..idx..' iterations (beam, dropped mass '..graph.droppedMass..')')
+      end
+   else
+      local nodeBel_old = nodeBel:clone()
+      local msg = zeros(nEdges*2,maxStates)
+      local msg_old = zeros(nEdges*2,maxStates)
+
+      -- propagate state normalizations
+      msg.gm.bpInitMessages(edgeEnds,nStates,msg)
+
+      -- do loopy belief propagation (if maxIter = 1, it's regular bp)
+      local idx
+      for i = 1,maxIter do
+         idx = i
+         -- pass messages, for all nodes (false = sum of products)
+         msg.gm.bpComputeMessages(nodePot,edgePot,edgeEnds,nStates,E,V,msg,false)
 
-   -- compute marginal node beliefs
-   msg.gm.bpComputeNodeBeliefs(nodePot,nodeBel,edgeEnds,nStates,E,V,product,msg)
+         -- check convergence
+         if (msg-msg_old):abs():sum() < 1e-4 then break end
+         msg_old:copy(msg)
+      end
+      if graph.verbose then
+         if idx == maxIter then
+            warning('<gm.infer.bp> reached max iterations ('..maxIter..') before convergence')
+         else
+            print('<gm.infer.bp> decoded graph in '..idx..' iterations')
+         end
+      end
 
-   -- compute marginal edge beliefs
-   msg.gm.bpComputeEdgeBeliefs(edgePot,edgeBel,nodeBel,edgeEnds,nStates,E,V,msg)
+      -- compute marginal node beliefs, pairwise beliefs and negative
+      -- free energy, in a single pass
+      logZ = msg.gm.bpComputeBeliefs(nodePot,edgePot,nodeBel,edgeBel,edgeEnds,nStates,E,V,msg)
+   end
 
-   -- compute negative free energy
-   local logZ = msg.gm.bpComputeLogZ(nodePot,edgePot,nodeBel,edgeBel,edgeEnds,nStates,E,V)
+   -- back to the user's node/edge order
+   if order then
+      nodeBel = nodeBel.new(nodeBel:size()):indexCopy(1,order.node,nodeBel)
+      edgeBel = edgeBel.new(edgeBel:size()):indexCopy(1,order.edge,edgeBel)
+   end
 
    -- return marginal beliefs, pairwise beliefs, and negative of free energy
    return nodeBel, edgeBel, logZ
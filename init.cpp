@@ -1,11 +1,60 @@
 #include "TH.h"
 #include "luaT.h"
+#include "gm.h"
+
+#include <unistd.h>
 
 #define torch_(NAME) TH_CONCAT_3(torch_, Real, NAME)
 #define torch_Tensor TH_CONCAT_STRING_3(torch., Real, Tensor)
 #define gm_(NAME) TH_CONCAT_3(gm_, Real, NAME)
 #define gm_energies_(NAME) TH_CONCAT_3(gm_energies_, Real, NAME)
 #define gm_infer_(NAME) TH_CONCAT_3(gm_infer_, Real, NAME)
+#define gm_dataset_(NAME) TH_CONCAT_3(gm_dataset_, Real, NAME)
+#define gm_parallel_(NAME) TH_CONCAT_3(gm_parallel_, Real, NAME)
+
+// storages viewing a dataset mapping hold a reference to it
+static void *gm_datasetMalloc(void *ctx, long size) {
+  THError("dataset tensors can't be resized");
+  return NULL;
+}
+static void *gm_datasetRealloc(void *ctx, void *ptr, long size) {
+  THError("dataset tensors can't be resized");
+  return NULL;
+}
+static void gm_datasetFree(void *ctx, void *ptr) {
+  ((gm::Dataset *)ctx)->release();
+}
+static THAllocator gm_datasetAllocator = {gm_datasetMalloc, gm_datasetRealloc, gm_datasetFree};
+
+static int gm_Dataset_free(lua_State *L) {
+  gm::Dataset *ds = (gm::Dataset *)luaT_checkudata(L, 1, "gm.Dataset");
+  ds->release();
+  return 0;
+}
+
+static int gm_DatasetWriter_free(lua_State *L) {
+  gm::DatasetWriter *writer = (gm::DatasetWriter *)luaT_checkudata(L, 1, "gm.DatasetWriter");
+  delete writer;
+  return 0;
+}
+
+static int gm_CompactPotentials_free(lua_State *L) {
+  gm::CompactPotentials *pot = (gm::CompactPotentials *)luaT_checkudata(L, 1, "gm.CompactPotentials");
+  delete pot;
+  return 0;
+}
+
+static int gm_JunctionTree_free(lua_State *L) {
+  gm::JunctionTree *jt = (gm::JunctionTree *)luaT_checkudata(L, 1, "gm.JunctionTree");
+  delete jt;
+  return 0;
+}
+
+static int gm_WorkerPool_free(lua_State *L) {
+  gm::WorkerPool *pool = (gm::WorkerPool *)luaT_checkudata(L, 1, "gm.WorkerPool");
+  delete pool;
+  return 0;
+}
 
 #include "generic/gm.c"
 #include "THGenerateFloatTypes.h"
@@ -16,6 +65,12 @@
 #include "generic/gm_energies.c"
 #include "THGenerateFloatTypes.h"
 
+#include "generic/gm_dataset.c"
+#include "THGenerateFloatTypes.h"
+
+#include "generic/gm_parallel.c"
+#include "THGenerateFloatTypes.h"
+
 extern "C" {
   DLL_EXPORT int luaopen_libgm(lua_State *L)
   {
@@ -25,9 +80,25 @@ extern "C" {
     gm_energies_FloatInit(L);
     gm_energies_DoubleInit(L);
 
+    luaT_newmetatable(L, "gm.CompactPotentials", NULL, NULL, gm_CompactPotentials_free, NULL);
+    lua_pop(L,1);
+    luaT_newmetatable(L, "gm.JunctionTree", NULL, NULL, gm_JunctionTree_free, NULL);
+    lua_pop(L,1);
     gm_infer_FloatInit(L);
     gm_infer_DoubleInit(L);
 
+    luaT_newmetatable(L, "gm.Dataset", NULL, NULL, gm_Dataset_free, NULL);
+    lua_pop(L,1);
+    luaT_newmetatable(L, "gm.DatasetWriter", NULL, NULL, gm_DatasetWriter_free, NULL);
+    lua_pop(L,1);
+    gm_dataset_FloatInit(L);
+    gm_dataset_DoubleInit(L);
+
+    luaT_newmetatable(L, "gm.WorkerPool", NULL, NULL, gm_WorkerPool_free, NULL);
+    lua_pop(L,1);
+    gm_parallel_FloatInit(L);
+    gm_parallel_DoubleInit(L);
+
     return 1;
   }
 }
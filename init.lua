@@ -49,13 +49,15 @@ require 'gm.energies'
 require 'gm.sample'
 require 'gm.examples'
 require 'gm.adjacency'
+require 'gm.dataset'
+require 'gm.parallel'
 
 ----------------------------------------------------------------------
 -- creates a graph
 --
 function gm.graph(...)
    -- usage
-   local args, adj, nStates, nodePot, edgePot, typ, maxIter, verbose = dok.unpack(
+   local args, adj, nStates, nodePot, edgePot, typ, maxIter, verbose, storage, halfMessages, maxTableSize, ordering, marginDecoder, beam, beamThreshold, edgeFeatures = dok.unpack(
       {...},
       'gm.graph',
       'create a graphical model from an adjacency matrix',
@@ -65,7 +67,15 @@ function gm.graph(...)
       {arg='edgePot', type='torch.Tensor', help='joint/edge potentials (N x nStates x nStates)'},
       {arg='type', type='string', help='type of graph: crf | mrf | generic', default='generic'},
       {arg='maxIter', type='number', help='maximum nb of iterations for loopy graphs', default=1},
-      {arg='verbose', type='boolean', help='verbose mode', default=false}
+      {arg='verbose', type='boolean', help='verbose mode', default=false},
+      {arg='storage', type='string', help='edge potential storage for bp: full | half | log16 | log8', default='full'},
+      {arg='halfMessages', type='boolean', help='store bp messages as fp16 (with compact storage)', default=false},
+      {arg='maxTableSize', type='number', help='largest junction tree (nb of clique table entries) jtree will build, before falling back to bp', default=1e7},
+      {arg='ordering', type='string', help='node/edge renumbering used internally by bp, for memory locality: none | bfs | rcm', default='none'},
+      {arg='marginDecoder', type='string', help='decoding method of the max-margin objective, g:nll(\'margin\',...): bp | jtree | exact', default='bp'},
+      {arg='beam', type='number', help='bp keeps the top-k states of each message (0 = all)', default=0},
+      {arg='beamThreshold', type='number', help='bp drops message states holding less than that share of its mass (0 = none)', default=0},
+      {arg='edgeFeatures', type='string', help='crf edge features generated from node features, when no Xedge is given: bias | absdiff | concat'}
    )
 
    -- shortcuts
@@ -176,6 +186,14 @@ function gm.graph(...)
    graph.adjacency = adj
    graph.maxIter = maxIter
    graph.verbose = verbose
+   graph.storage = storage
+   graph.halfMessages = halfMessages
+   graph.maxTableSize = maxTableSize
+   graph.ordering = ordering
+   graph.marginDecoder = marginDecoder
+   graph.beam = beam
+   graph.beamThreshold = beamThreshold
+   graph.edgeFeatures = edgeFeatures
    graph.type = args.type
    graph.timer = torch.Timer()
 
@@ -186,9 +204,17 @@ function gm.graph(...)
       xlua.error('unknown graph type: ' .. graph.type, 'gm.graph')
    end
 
-   -- store nodePot/edgePot if given
-   graph.nodePot = nodePot
-   graph.edgePot = edgePot
+   -- locality-improving renumbering: bp runs on a copy of the topology
+   -- where each node's neighbours (and their edges) sit close in memory,
+   -- and maps its results back; the graph itself keeps the user's order
+   if ordering ~= 'none' then
+      local order = {}
+      order.node, order.edge, order.edgeEnds, order.V, order.E, order.nStates
+         = edgeEnds.gm.orderGraph(edgeEnds, graph.nStates, ordering)
+      order.node = order.node:long()
+      order.edge = order.edge:long()
+      graph.order = order
+   end
 
    -- some functions
    graph.getEdgesOf = function(g,node)
@@ -220,7 +246,38 @@ function gm.graph(...)
          xlua.error('missing arguments','setPotentials')
       end
       g.nodePot = nodePot
-      g.edgePot = edgePot
+      if g.storage and g.storage ~= 'full' then
+         -- compact storage: edge potentials are encoded once, in the
+         -- order bp runs in, and only the packed form is kept
+         local edgeEnds,nStates = g.edgeEnds,g.nStates
+         if g.order then
+            edgePot = edgePot:index(1,g.order.edge)
+            edgeEnds,nStates = g.order.edgeEnds,g.order.nStates
+         end
+         g.compactPot = edgePot.gm.compactPotentials(edgePot,edgeEnds,nStates,g.storage)
+         g.edgePot = nil
+      else
+         g.edgePot = edgePot
+         g.compactPot = nil
+      end
+   end
+
+   graph.getEdgePot = function(g)
+      -- full edge potentials; with compact storage, a decoded copy
+      if g.edgePot or not g.compactPot then
+         return g.edgePot
+      end
+      local maxStates = g.nodePot:size(2)
+      local edgeEnds,nStates = g.edgeEnds,g.nStates
+      if g.order then
+         edgeEnds,nStates = g.order.edgeEnds,g.order.nStates
+      end
+      local edgePot = g.nodePot.new(g.nEdges,maxStates,maxStates):zero()
+      edgePot.gm.expandPotentials(g.compactPot,edgeEnds,nStates,edgePot)
+      if g.order then
+         edgePot = edgePot.new(edgePot:size()):indexCopy(1,g.order.edge,edgePot)
+      end
+      return edgePot
    end
 
    graph.decode = function(g,method,maxIter)
@@ -309,16 +366,16 @@ function gm.graph(...)
       local args = {...}
       if g.type == 'crf' then
          Xnode = args[1]
-         Xedge = args[2]
+         Xedge = args[2] or g.edgeFeatures
       end
       if not g.w then
          xlua.error('graph doesnt have parameters, call g:initParameters() first','makePotentials')
       end
-      if (g.type == 'crf' and not Xnode) then
+      if (g.type == 'crf' and not (Xnode and Xedge)) then
          print(xlua.usage('makePotentials',
                'make potentials from internal parameters (for crf graphs) and given node/edge features', nil,
                {type='torch.Tensor', help='node features', req=true},
-               {type='torch.Tensor', help='edge features', req=true}))
+               {type='torch.Tensor | string', help='edge features, or recipe: bias | absdiff | concat', req=true}))
          xlua.error('missing arguments / incorrect graph','makePotentials')
       end
       gm.energies[g.type].makePotentials(g,g.w,g.nodeMap,g.edgeMap,Xnode,Xedge)
@@ -328,24 +385,32 @@ function gm.graph(...)
       if not g.w then
          xlua.error('graph doesnt have parameters, call g:initParameters() first','nll')
       end
-      if not Y or not method or not gm.infer[method] or not gm.energies[g.type] then
+      -- objectives other than the inference-based likelihood, picked by
+      -- name: each one has its own gm.energies function (local
+      -- likelihoods, or max-margin, which decodes)
+      local objectives = {pseudo=true, piecewise=true, margin=true}
+      Xedge = Xedge or g.edgeFeatures
+      if not Y or not method or not (gm.infer[method] or objectives[method]) or not gm.energies[g.type] then
          local availmethods = {}
          for k in pairs(gm.infer) do
             table.insert(availmethods,k)
          end
+         for k in pairs(objectives) do
+            table.insert(availmethods,k)
+         end
          availmethods = table.concat(availmethods, ' | ')
          if g.type == 'crf' then
             print(xlua.usage('nll',
                'compute negative log-likelihood of CRF, and its gradient wrt weights', nil,
-               {type='string', help='inference method: ' .. availmethods, req=true},
+               {type='string', help='inference method, or objective: ' .. availmethods, req=true},
                {type='torch.Tensor', help='labeling', req=true},
                {type='torch.Tensor', help='node features', req=true},
-               {type='torch.Tensor', help='edge features', req=true}
+               {type='torch.Tensor | string', help='edge features, or recipe: bias | absdiff | concat', req=true}
                ))
          elseif g.type == 'mrf' then
             print(xlua.usage('nll',
                'compute negative log-likelihood of MRF, and its gradient wrt weights', nil,
-               {type='string', help='inference method: ' .. availmethods, req=true},
+               {type='string', help='inference method, or objective: ' .. availmethods, req=true},
                {type='torch.Tensor', help='node values', req=true}
                ))
          end
@@ -353,16 +418,18 @@ function gm.graph(...)
       end
       graph.timer:reset()
       local f,grad
+      local energy = gm.energies[g.type]
+      local nll = objectives[method] and energy[method] or energy.nll
       if g.type == 'crf' then
-         f,grad = gm.energies[g.type].nll(g, g.w,
-                                       g.nodeMap,g.edgeMap, method,
-                                       g.maxIter,
-                                       Y, Xnode, Xedge)
+         f,grad = nll(g, g.w,
+                      g.nodeMap,g.edgeMap, method,
+                      g.maxIter,
+                      Y, Xnode, Xedge)
       elseif g.type == 'mrf' then
-         f,grad = gm.energies[g.type].nll(g, g.w,
-                                       g.nodeMap,g.edgeMap, method,
-                                       g.maxIter,
-                                       Y)
+         f,grad = nll(g, g.w,
+                      g.nodeMap,g.edgeMap, method,
+                      g.maxIter,
+                      Y)
       end
       local t = graph.timer:time()
       if g.verbose then
@@ -371,26 +438,77 @@ function gm.graph(...)
       return f,grad
    end
 
-   graph.getPotentialForConfig = function(g,y)
+   graph.junctionTree = function(g,heuristic)
+      -- triangulate once (topology only), and keep the tree around
+      heuristic = heuristic or 'minfill'
+      if not g.jtree or g.jtree.heuristic ~= heuristic then
+         local tree,cost,width = g.edgeEnds.gm.junctionTree(g.edgeEnds,g.nStates,heuristic)
+         g.jtree = {tree=tree, cost=cost, width=width, heuristic=heuristic}
+      end
+      -- return total nb of clique table entries, and treewidth
+      return g.jtree.cost, g.jtree.width
+   end
+
+   graph.getPotentialForConfig = function(g,y,edgePot)
       if not y then
          print(xlua.usage('getPotentialForConfig',
                'get potential for a given configuration', nil,
-               {type='torch.Tensor', help='configuration of all nodes in graph', req=true}))
+               {type='torch.Tensor', help='configuration of all nodes in graph', req=true},
+               {type='torch.Tensor', help='edge potentials, from getEdgePot (default: decoded on each call)'}))
          xlua.error('missing config','getPotentialForConfig')
       end
       -- return potential
-      return g.nodePot.gm.getPotentialForConfig(g.nodePot,g.edgePot,g.edgeEnds,y)
+      edgePot = edgePot or g:getEdgePot()
+      return g.nodePot.gm.getPotentialForConfig(g.nodePot,edgePot,g.edgeEnds,y)
    end
 
-   graph.getLogPotentialForConfig = function(g,y)
+   graph.getLogPotentialForConfig = function(g,y,edgePot)
       if not y then
          print(xlua.usage('getLogPotentialForConfig',
                'get log potential for a given configuration', nil,
-               {type='torch.Tensor', help='configuration of all nodes in graph', req=true}))
+               {type='torch.Tensor', help='configuration of all nodes in graph', req=true},
+               {type='torch.Tensor', help='edge potentials, from getEdgePot (default: decoded on each call)'}))
          xlua.error('missing config','getPotentialForConfig')
       end
       -- return potential
-      return g.nodePot.gm.getLogPotentialForConfig(g.nodePot,g.edgePot,g.edgeEnds,y)
+      edgePot = edgePot or g:getEdgePot()
+      return g.nodePot.gm.getLogPotentialForConfig(g.nodePot,edgePot,g.edgeEnds,y)
+   end
+
+   graph.getLogPotentialsForConfigs = function(g,Y,terms,edgePot)
+      if not Y then
+         print(xlua.usage('getLogPotentialsForConfigs',
+               'get log potentials for a batch of configurations (natively, in parallel)', nil,
+               {type='torch.Tensor', help='K configurations of all nodes in graph (K x N)', req=true},
+               {type='boolean', help='also return each node and edge log potential (K x N, K x E)', default=false},
+               {type='torch.Tensor', help='edge potentials, from getEdgePot (default: decoded on each call)'}))
+         xlua.error('missing configs','getLogPotentialsForConfigs')
+      end
+      -- return K log potentials, and their terms (callers that score many
+      -- batches pass edgePot, so compact storage is decoded only once)
+      edgePot = edgePot or g:getEdgePot()
+      if terms then
+         local nodeTerms = g.nodePot.new(Y:size(1),g.nNodes)
+         local edgeTerms = g.nodePot.new(Y:size(1),g.nEdges)
+         local logpot = g.nodePot.gm.getLogPotentialsForConfigs(g.nodePot,edgePot,g.edgeEnds,Y,
+                                                                nodeTerms,edgeTerms)
+         return logpot,nodeTerms,edgeTerms
+      end
+      return g.nodePot.gm.getLogPotentialsForConfigs(g.nodePot,edgePot,g.edgeEnds,Y)
+   end
+
+   graph.getConfigs = function(g,first,count)
+      -- configurations first .. first+count-1 (0-based), in the order
+      -- exhaustive methods enumerate them: node 1 varies fastest
+      -- (in the potentials' type, which the config bindings dispatch on)
+      local Y = g.nodePot.new(count,g.nNodes)
+      local index = g.nodePot.new():range(first,first+count-1)
+      local stride = 1
+      for n = 1,g.nNodes do
+         Y:select(2,n):copy(index):div(stride):floor():fmod(g.nStates[n]):add(1)
+         stride = stride * g.nStates[n]
+      end
+      return Y
    end
 
    local tostring = function(g)
@@ -408,6 +526,14 @@ function gm.graph(...)
       print(tostring(graph))
    end
 
+   -- store nodePot/edgePot if given (encoded right away with compact
+   -- storage)
+   graph.nodePot = nodePot
+   graph.edgePot = edgePot
+   if nodePot and edgePot then
+      graph:setPotentials(nodePot,edgePot)
+   end
+
    -- return result
    return graph
 end
@@ -0,0 +1,146 @@
+----------------------------------------------------------------------
+--
+-- Copyright (c) 2012 Clement Farabet
+--
+-- Permission is hereby granted, free of charge, to any person obtaining
+-- a copy of this software and associated documentation files (the
+-- "Software"), to deal in the Software without restriction, including
+-- without limitation the rights to use, copy, modify, merge, publish,
+-- distribute, sublicense, and/or sell copies of the Software, and to
+-- permit persons to whom the Software is furnished to do so, subject to
+-- the following conditions:
+--
+-- The above copyright notice and this permission notice shall be
+-- included in all copies or substantial portions of the Software.
+--
+-- THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+-- EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+-- MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+-- NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS BE
+-- LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN ACTION
+-- OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN CONNECTION
+-- WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+--
+----------------------------------------------------------------------
+-- description:
+--     gm.parallel - data-parallel training over forked worker
+--                   processes, on a single host
+--
+-- history:
+--     October 2026 - initial draft - agent
+----------------------------------------------------------------------
+
+-- that table contains the parallel training functions
+gm.parallel = {}
+
+-- shortcuts
+local floor = math.floor
+
+----------------------------------------------------------------------
+-- worker loop: owns instances first..first+n-1, and computes the nll
+-- and gradient of a (random batch of its) shard at each step. Never
+-- returns.
+--
+local function work(lib,pool,id,graph,method,Y,Xnode,Xedge,first,n)
+   -- a single thread per worker (OpenMP isn't fork-safe, and the parent
+   -- may have started its threads already), and a different random stream
+   torch.setnumthreads(1)
+   torch.manualSeed(torch.initialSeed() + id)
+
+   -- copy shard, now that the worker is pinned, so that it is allocated
+   -- on its own NUMA node
+   local shard = function(X)
+      if type(X) == 'string' then return X end -- edge feature recipe
+      return X and n > 0 and X:narrow(1,first,n):clone() or nil
+   end
+   Y, Xnode, Xedge = shard(Y), shard(Xnode), shard(Xedge)
+
+   while true do
+      -- wait for new parameters
+      local batchSize = lib.poolNext(pool,id,graph.w)
+      if not batchSize then break end
+
+      -- nll and gradient over the shard, or a random batch of it
+      local ok,f,grad = pcall(function()
+         if n == 0 then return 0 end
+         local y,xnode,xedge = Y,Xnode,Xedge
+         if batchSize > 0 and batchSize < n then
+            local idx = torch.LongTensor(batchSize):random(1,n)
+            y = Y:index(1,idx)
+            xnode = Xnode and Xnode:index(1,idx)
+            xedge = torch.isTensor(Xedge) and Xedge:index(1,idx) or Xedge
+         end
+         return graph:nll(method,y,xnode,xedge)
+      end)
+      if ok then
+         lib.poolFinish(pool,id,f,grad)
+      else
+         lib.poolFinish(pool,id,0,nil,tostring(f))
+      end
+   end
+   lib.poolExit()
+end
+
+----------------------------------------------------------------------
+-- creates a data-parallel trainer: instances are split into one shard
+-- per worker process, and w and the gradients are exchanged through
+-- shared memory. trainer.feval is a drop-in objective for optim:
+--
+--   local trainer = gm.parallel.trainer{graph=g, method='bp', Y=Y,
+--                                       Xnode=Xnode, Xedge=Xedge}
+--   optim.lbfgs(trainer.feval, g.w, {maxIter=100})
+--   trainer:close()
+--
+-- With trainer.batchSize > 0, each worker uses a random batch of that
+-- many instances of its shard at each step (e.g. for optim.sgd).
+--
+function gm.parallel.trainer(...)
+   -- usage
+   local args, graph, method, Y, Xnode, Xedge, nWorkers, numa, batchSize = dok.unpack(
+      {...},
+      'gm.parallel.trainer',
+      'data-parallel nll and gradient, over forked worker processes',
+      {arg='graph', type='table', help='graph, with parameters (see graph:initParameters())', req=true},
+      {arg='method', type='string', help='inference method, or local objective, as in graph:nll()', req=true},
+      {arg='Y', type='torch.Tensor', help='labelings (crf) or node values (mrf)', req=true},
+      {arg='Xnode', type='torch.Tensor', help='node features (crf)'},
+      {arg='Xedge', type='torch.Tensor | string', help='edge features, or recipe (crf): bias | absdiff | concat'},
+      {arg='workers', type='number', help='nb of worker processes', default=2},
+      {arg='numa', type='boolean', help='pin workers to NUMA nodes, round-robin', default=true},
+      {arg='batchSize', type='number', help='instances per worker and step (0 = whole shard)', default=0}
+   )
+   if not graph.w then
+      xlua.error('graph doesnt have parameters, call g:initParameters() first','gm.parallel.trainer')
+   end
+
+   -- shared memory, and workers
+   local lib = graph.w.gm
+   local pool = lib.poolCreate(nWorkers, graph.w:nElement())
+   local nInstances = Y:size(1)
+   local id = lib.poolSpawn(pool, numa)
+   if id > 0 then
+      local first = floor((id-1)*nInstances/nWorkers) + 1
+      local last = floor(id*nInstances/nWorkers)
+      work(lib,pool,id,graph,method,Y,Xnode,Xedge,first,last-first+1)
+   end
+
+   -- parent
+   local trainer = {pool=pool, workers=nWorkers, batchSize=batchSize}
+
+   -- total nll and gradient at w, over all workers
+   trainer.feval = function(w)
+      local grad = graph.w.new(graph.w:size())
+      local f = lib.poolStep(pool, w, trainer.batchSize, grad)
+      if graph.verbose then
+         print('<gm.parallel> computed nll over '..nWorkers..' workers: '..f)
+      end
+      return f,grad
+   end
+
+   -- stops and reaps the workers
+   trainer.close = function(t)
+      lib.poolStop(t.pool)
+   end
+
+   return trainer
+end
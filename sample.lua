@@ -48,109 +48,55 @@ end
 ----------------------------------------------------------------------
 -- Helpers
 --
-local function computeZ(g)
-   -- Locals
-   local Tensor = torch.Tensor
-   local nodePot = g.nodePot
-   local edgePot = g.edgePot
-   local edgeEnds = g.edgeEnds
-   local nStates = g.nStates
-   local nNodes = g.nNodes
-   local nEdges = g.nEdges
-   local maxStates = g.nodePot:size(2)
-   
-   -- Compute Z
-   local y = ones(nNodes)
-   local Z = 0
-   while true do
-      local pot = 1
+local batch = 4096
 
-      -- Nodes
-      for n = 1,nNodes do
-         pot = pot*nodePot[n][y[n]]
-      end
-
-      -- Edges
-      for e = 1,nEdges do
-         local n1 = edgeEnds[e][1]
-         local n2 = edgeEnds[e][2]
-         pot = pot*edgePot[e][y[n1]][y[n2]]
-      end
-
-      -- Update Z
-      Z = Z + pot
-
-      -- Go to next y
-      for yInd = 1,nNodes do
-         y[yInd] = y[yInd] + 1
-         if y[yInd] <= nStates[yInd] then
-            break
-         else
-            y[yInd] = 1
-         end
+-- log(Z), from the log potentials of all configurations, scored
+-- natively a batch at a time (edgePot is decoded once, by the caller)
+local function computeLogZ(g,edgePot)
+   local nConfigs = g.nStates:prod()
+   local shift = -math.huge
+   local Z = 0
+   for first = 0,nConfigs-1,batch do
+      local configs = g:getConfigs(first,math.min(batch,nConfigs-first))
+      local logpot = g:getLogPotentialsForConfigs(configs,false,edgePot)
+
+      -- rescale the partial sum when the largest potential grows
+      local top = logpot:max()
+      if top > shift then
+         Z = Z*math.exp(shift-top)
+         shift = top
       end
-
-      -- Stop when we are done all y combinations
-      if y:eq(1):sum() == nNodes then
-         break
+      if shift > -math.huge then
+         Z = Z + logpot:add(-shift):exp():sum()
       end
    end
-
-   -- Return Z
-   return Z
+   return shift + math.log(Z)
 end
 
-local function sampleY(g,Z)
-   -- Locals
-   local Tensor = torch.Tensor
-   local nodePot = g.nodePot
-   local edgePot = g.edgePot
-   local edgeEnds = g.edgeEnds
-   local nStates = g.nStates
-   local nNodes = g.nNodes
-   local nEdges = g.nEdges
-   local maxStates = g.nodePot:size(2)
-
-   -- Sample...
-   local y = ones(nNodes)
+local function sampleY(g,logZ,edgePot)
+   local nConfigs = g.nStates:prod()
    local cumulativePot = 0
    local U = uniform(0,1)
-   while true do
-      local pot = 1
-
-      -- Nodes
-      for n = 1,nNodes do
-         pot = pot * nodePot[n][y[n]]
-      end
-
-      -- Edges
-      for e = 1,nEdges do
-         local n1 = edgeEnds[e][1]
-         local n2 = edgeEnds[e][2]
-         pot = pot*edgePot[e][y[n1]][y[n2]]
-      end
-
-      -- Update cumulative potential
-      cumulativePot = cumulativePot + pot
-
-      if cumulativePot/Z > U then
-         -- Take this y
-         break
-      end
-
-      -- Go to next y
-      for yInd = 1,nNodes do
-         y[yInd] = y[yInd] + 1
-         if y[yInd] <= nStates[yInd] then
-            break
-         else
-            y[yInd] = 1
+   local configs
+   for first = 0,nConfigs-1,batch do
+      configs = g:getConfigs(first,math.min(batch,nConfigs-first))
+      local cumulative = g:getLogPotentialsForConfigs(configs,false,edgePot):add(-logZ):exp():cumsum()
+      cumulative:add(cumulativePot)
+
+      -- take the first y whose cumulative probability passes U
+      local count = cumulative:size(1)
+      if cumulative[count] > U then
+         for i = 1,count do
+            if cumulative[i] > U then
+               return configs[i]
+            end
          end
       end
+      cumulativePot = cumulative[count]
    end
 
-   -- Samples
-   return y
+   -- rounding: last configuration
+   return configs[configs:size(1)]
 end
 
 -- Returns a sample from a discrete probability mass function indexed by p
@@ -178,13 +124,14 @@ function gm.sample.exact(g, N)
       print('<gm.sample.exact> doing exact sampling')
    end
 
-   -- Z
-   local Z = computeZ(g)
+   -- log(Z)
+   local edgePot = g:getEdgePot()
+   local logZ = computeLogZ(g,edgePot)
 
    -- Samples
-   local samples = zeros(N,nNodes)
+   local samples = zeros(N,g.nNodes)
    for i = 1,N do
-      samples[i] = sampleY(g,Z)
+      samples[i] = sampleY(g,logZ,edgePot)
    end
    return samples
 end
@@ -199,7 +146,7 @@ function gm.sample.gibbs(g, N, burnIn)
    -- Locals
    local Tensor = torch.Tensor
    local nodePot = g.nodePot
-   local edgePot = g.edgePot
+   local edgePot = g:getEdgePot()
    local edgeEnds = g.edgeEnds
    local nStates = g.nStates
    local nNodes = g.nNodes
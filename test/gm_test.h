@@ -0,0 +1,97 @@
+#ifndef GM_TEST_H
+#define GM_TEST_H
+
+// Minimal helpers for the gmcore tests: checks, small random models, and
+// brute-force references (every configuration is enumerated).
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+#include "gm.h"
+
+static int gm_failures = 0;
+
+#define CHECK(cond) do { \
+    if (!(cond)) { \
+      fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+      gm_failures++; \
+    } \
+  } while (0)
+
+#define CHECK_CLOSE(a, b, tol) do { \
+    double a_ = (a), b_ = (b); \
+    if (!(fabs(a_ - b_) <= (tol))) { \
+      fprintf(stderr, "%s:%d: check failed: %s = %g, %s = %g\n", \
+              __FILE__, __LINE__, #a, a_, #b, b_); \
+      gm_failures++; \
+    } \
+  } while (0)
+
+#define TEST_RESULT() \
+  (gm_failures ? (fprintf(stderr, "%d check(s) failed\n", gm_failures), 1) : 0)
+
+static inline double uniform() {
+  return rand() / (double)RAND_MAX;
+}
+
+// random positive potentials, zero outside each node's states
+template <typename real>
+static void randomPotentials(const gm::Graph<real> &g, std::vector<real> &nodePot,
+                             std::vector<real> &edgePot) {
+  long S = g.maxStates;
+  nodePot.assign(g.nNodes*S, 0);
+  edgePot.assign(g.nEdges*S*S, 0);
+  for (long n = 0; n < g.nNodes; n++) {
+    for (long s = 0; s < g.nStates[n]; s++) nodePot[n*S+s] = exp(2*uniform()-1);
+  }
+  for (long e = 0; e < g.nEdges; e++) {
+    long nS1 = g.nStates[(long)g.edgeEnds[e*2+0]-1];
+    long nS2 = g.nStates[(long)g.edgeEnds[e*2+1]-1];
+    for (long s1 = 0; s1 < nS1; s1++) {
+      for (long s2 = 0; s2 < nS2; s2++) edgePot[(e*S+s1)*S+s2] = exp(2*uniform()-1);
+    }
+  }
+}
+
+// next configuration (1-based labels, node 0 fastest); false after the last
+template <typename real>
+static bool nextConfig(const gm::Graph<real> &g, std::vector<real> &y) {
+  for (long n = 0; n < g.nNodes; n++) {
+    if (++y[n] <= g.nStates[n]) return true;
+    y[n] = 1;
+  }
+  return false;
+}
+
+// exact log(Z), node/edge marginals and MAP configuration, by enumeration
+template <typename real>
+static double bruteForce(const gm::Graph<real> &g, const real *nodePot,
+                         const real *edgePot, std::vector<double> &nodeBel,
+                         std::vector<double> &edgeBel, std::vector<real> &map) {
+  long S = g.maxStates;
+  nodeBel.assign(g.nNodes*S, 0);
+  edgeBel.assign(g.nEdges*S*S, 0);
+  std::vector<real> y(g.nNodes, 1);
+  double Z = 0, best = -1;
+  do {
+    double p = gm::potentialForConfig(g, nodePot, edgePot, &y[0]);
+    Z += p;
+    if (p > best) {
+      best = p;
+      map = y;
+    }
+    for (long n = 0; n < g.nNodes; n++) nodeBel[n*S+(long)y[n]-1] += p;
+    for (long e = 0; e < g.nEdges; e++) {
+      long s1 = (long)y[(long)g.edgeEnds[e*2+0]-1]-1;
+      long s2 = (long)y[(long)g.edgeEnds[e*2+1]-1]-1;
+      edgeBel[(e*S+s1)*S+s2] += p;
+    }
+  } while (nextConfig(g, y));
+  for (size_t i = 0; i < nodeBel.size(); i++) nodeBel[i] /= Z;
+  for (size_t i = 0; i < edgeBel.size(); i++) edgeBel[i] /= Z;
+  return log(Z);
+}
+
+#endif
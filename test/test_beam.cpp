@@ -0,0 +1,48 @@
+// Beam bp on a tree with 6 states per node: without pruning it is exact
+// (against brute force), and with a narrow beam it reports what it drops
+// and still decodes a peaked model.
+
+#include "gm_test.h"
+
+int main() {
+  srand(10);
+  long nNodes = 6, nEdges = 5;
+  long edges[] = {1,2, 2,3, 2,4, 4,5, 4,6};
+  long nStates[] = {6,6,5,6,4,6};
+  gm::GraphStorage<double> storage;
+  gm::makeGraph<double>(nNodes, nEdges, edges, nStates, storage);
+  gm::Graph<double> g = storage.graph();
+  long S = g.maxStates;
+
+  std::vector<double> nodePot, edgePot;
+  randomPotentials(g, nodePot, edgePot);
+  std::vector<double> exactNode, exactEdge, map;
+  double exactLogZ = bruteForce(g, &nodePot[0], &edgePot[0], exactNode, exactEdge, map);
+
+  // every state kept: messages have no floor, and bp is exact
+  std::vector<double> nodeBel(nNodes*S), edgeBel(nEdges*S*S);
+  std::vector<long> config(nNodes);
+  double logZ, dropped;
+  CHECK(gm::inferBeamBP(g, &nodePot[0], &edgePot[0], 0, 0, 10, &nodeBel[0], &edgeBel[0], &logZ, &dropped) > 0);
+  CHECK(dropped < 1e-12);
+  CHECK_CLOSE(logZ, exactLogZ, 1e-6);
+  for (long i = 0; i < nNodes*S; i++) CHECK_CLOSE(nodeBel[i], exactNode[i], 1e-6);
+  for (long i = 0; i < nEdges*S*S; i++) CHECK_CLOSE(edgeBel[i], exactEdge[i], 1e-6);
+  CHECK(gm::decodeBeamBP(g, &nodePot[0], &edgePot[0], 0, 0, 10, &nodeBel[0], &config[0], &dropped) > 0);
+  for (long n = 0; n < nNodes; n++) CHECK(config[n] == map[n]);
+
+  // a beam of 2 on a peaked model
+  for (long n = 0; n < nNodes; n++) nodePot[n*S + rand() % nStates[n]] *= 100;
+  bruteForce(g, &nodePot[0], &edgePot[0], exactNode, exactEdge, map);
+  CHECK(gm::inferBeamBP(g, &nodePot[0], &edgePot[0], 2, 0, 10, &nodeBel[0], &edgeBel[0], &logZ, &dropped) > 0);
+  CHECK(dropped > 0 && dropped < 2);
+  for (long n = 0; n < nNodes; n++) {
+    double sum = 0;
+    for (long s = 0; s < nStates[n]; s++) sum += nodeBel[n*S+s];
+    CHECK_CLOSE(sum, 1, 1e-9);
+  }
+  CHECK(gm::decodeBeamBP(g, &nodePot[0], &edgePot[0], 2, 0, 10, &nodeBel[0], &config[0], &dropped) > 0);
+  for (long n = 0; n < nNodes; n++) CHECK(config[n] == map[n]);
+
+  return TEST_RESULT();
+}
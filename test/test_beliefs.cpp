@@ -0,0 +1,43 @@
+// Fused beliefs and Bethe log(Z) (bpComputeBeliefs) against the separate
+// node belief, edge belief and log(Z) kernels, on a loopy graph, for both
+// float and double.
+
+#include "gm_test.h"
+
+template <typename real>
+static void check(double tol) {
+  long nNodes = 5, nEdges = 7;
+  long edges[] = {1,2, 2,3, 3,4, 4,5, 1,5, 1,3, 2,4};
+  long nStates[] = {2,3,4,2,3};
+  gm::GraphStorage<real> storage;
+  gm::makeGraph<real>(nNodes, nEdges, edges, nStates, storage);
+  gm::Graph<real> g = storage.graph();
+  long S = g.maxStates;
+
+  std::vector<real> nodePot, edgePot;
+  randomPotentials(g, nodePot, edgePot);
+  std::vector<real> msg(2*nEdges*S);
+  gm::bpInitMessages(g, &msg[0]);
+  for (int i = 0; i < 5; i++) CHECK(gm::bpComputeMessages(g, &nodePot[0], &edgePot[0], &msg[0], false));
+
+  // separate kernels
+  std::vector<real> nodeBel(nNodes*S), edgeBel(nEdges*S*S);
+  CHECK(gm::bpComputeNodeBeliefs(g, &nodePot[0], &msg[0], &nodeBel[0]));
+  CHECK(gm::bpComputeEdgeBeliefs(g, &edgePot[0], &nodeBel[0], &msg[0], &edgeBel[0]));
+  std::vector<real> nodeRef(nodeBel), edgeRef(edgeBel);
+  double logZRef = gm::bpComputeLogZ(g, &nodePot[0], &edgePot[0], &nodeBel[0], &edgeBel[0]);
+
+  // fused
+  double logZ;
+  CHECK(gm::bpComputeBeliefs(g, &nodePot[0], &edgePot[0], &msg[0], &nodeBel[0], &edgeBel[0], &logZ));
+  CHECK_CLOSE(logZ, logZRef, tol);
+  for (long i = 0; i < nNodes*S; i++) CHECK_CLOSE(nodeBel[i], nodeRef[i], tol);
+  for (long i = 0; i < nEdges*S*S; i++) CHECK_CLOSE(edgeBel[i], edgeRef[i], tol);
+}
+
+int main() {
+  srand(3);
+  check<double>(1e-9);
+  check<float>(1e-4);
+  return TEST_RESULT();
+}
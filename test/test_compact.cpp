@@ -0,0 +1,95 @@
+// Compact edge potentials: encode/decode round trips of each storage
+// (including the table-driven decoding of large tables, and fp16 tables
+// far outside fp16's range), and compact belief propagation against the
+// dense one.
+
+#include "gm_test.h"
+
+static const int kStorages[] = {gm::kStorageHalf, gm::kStorageLog16, gm::kStorageLog8};
+
+// decodes every table of pot, and checks it against edgePot with a
+// relative tolerance
+template <typename real>
+static void checkRoundTrip(const gm::Graph<real> &g, const std::vector<real> &edgePot,
+                           int storage, double tol) {
+  long S = g.maxStates;
+  gm::CompactPotentials pot;
+  gm::compactPotentials(g, &edgePot[0], storage, pot);
+  std::vector<real> table(S*S);
+  for (long e = 0; e < g.nEdges; e++) {
+    long nS1 = g.nStates[(long)g.edgeEnds[e*2+0]-1];
+    long nS2 = g.nStates[(long)g.edgeEnds[e*2+1]-1];
+    gm::expandPotentials(pot, e, nS1, nS2, &table[0]);
+    for (long s1 = 0; s1 < nS1; s1++) {
+      for (long s2 = 0; s2 < nS2; s2++) {
+        double x = edgePot[(e*S+s1)*S+s2], d = table[s1*S+s2];
+        if (x == 0) CHECK(d == 0);
+        else CHECK_CLOSE(d/x, 1, tol);
+      }
+    }
+  }
+}
+
+int main() {
+  srand(4);
+
+  // large tables (24 x 24, 24 x 2) go through the exp() tables, small
+  // ones through exp() directly; a few hard zeros
+  long edges[] = {1,2, 2,3};
+  long nStates[] = {24,24,2};
+  gm::GraphStorage<double> storage;
+  gm::makeGraph<double>(3, 2, edges, nStates, storage);
+  gm::Graph<double> g = storage.graph();
+  std::vector<double> nodePot, edgePot;
+  randomPotentials(g, nodePot, edgePot);
+  edgePot[5] = edgePot[24*24+1] = 0;
+  checkRoundTrip(g, edgePot, gm::kStorageHalf, 1e-3);
+  checkRoundTrip(g, edgePot, gm::kStorageLog16, 1e-4);
+  checkRoundTrip(g, edgePot, gm::kStorageLog8, 1e-2);
+
+  // potentials of exp(scores) beyond fp16's range, large and small
+  for (size_t i = 0; i < edgePot.size(); i++) edgePot[i] *= exp(20.0);
+  checkRoundTrip(g, edgePot, gm::kStorageHalf, 1e-3);
+  for (size_t i = 0; i < edgePot.size(); i++) edgePot[i] *= exp(-45.0);
+  checkRoundTrip(g, edgePot, gm::kStorageHalf, 1e-3);
+
+  // entries too small for fp16 next to the table's max stay nonzero
+  edgePot[0] = 1;
+  edgePot[1] = 1e-12;
+  gm::CompactPotentials pot;
+  gm::compactPotentials(g, &edgePot[0], gm::kStorageHalf, pot);
+  std::vector<double> table(24*24);
+  gm::expandPotentials(pot, 0, 24, 24, &table[0]);
+  CHECK(table[1] > 0 && table[1] < 1e-6);
+
+  // compact bp on a loopy graph, against dense bp
+  long loopEdges[] = {1,2, 2,3, 3,4, 4,1, 1,3};
+  long loopStates[] = {3,2,4,3};
+  gm::GraphStorage<float> loopStorage;
+  gm::makeGraph<float>(4, 5, loopEdges, loopStates, loopStorage);
+  gm::Graph<float> lg = loopStorage.graph();
+  long S = lg.maxStates;
+  std::vector<float> np, ep;
+  randomPotentials(lg, np, ep);
+  std::vector<float> nodeRef(4*S), edgeRef(5*S*S), nodeBel(4*S), edgeBel(5*S*S);
+  double logZRef, logZ;
+  CHECK(gm::inferBP(lg, &np[0], &ep[0], 50, &nodeRef[0], &edgeRef[0], &logZRef) > 0);
+  std::vector<long> configRef(4), config(4);
+  std::vector<float> maxBel(4*S);
+  CHECK(gm::decodeBP(lg, &np[0], &ep[0], 50, &maxBel[0], &configRef[0]) > 0);
+  for (int k = 0; k < 3; k++) {
+    double tol = kStorages[k] == gm::kStorageLog8 ? 2e-2 : 2e-3;
+    gm::CompactPotentials cp;
+    gm::compactPotentials(lg, &ep[0], kStorages[k], cp);
+    for (int half = 0; half < 2; half++) {
+      CHECK(gm::inferBP(lg, &np[0], cp, half != 0, 50, &nodeBel[0], &edgeBel[0], &logZ) > 0);
+      CHECK_CLOSE(logZ, logZRef, tol);
+      for (long i = 0; i < 4*S; i++) CHECK_CLOSE(nodeBel[i], nodeRef[i], tol);
+      for (long i = 0; i < 5*S*S; i++) CHECK_CLOSE(edgeBel[i], edgeRef[i], tol);
+      CHECK(gm::decodeBP(lg, &np[0], cp, half != 0, 50, &maxBel[0], &config[0]) > 0);
+      if (kStorages[k] != gm::kStorageLog8) CHECK(config == configRef);
+    }
+  }
+
+  return TEST_RESULT();
+}
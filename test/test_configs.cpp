@@ -0,0 +1,57 @@
+// Batched scoring of configurations (logPotentialsForConfigs), for every
+// configuration of a loopy graph, against logPotentialForConfig one at a
+// time, with and without the per node and per edge terms.
+
+#include "gm_test.h"
+
+int main() {
+  srand(11);
+  long nNodes = 5, nEdges = 6;
+  long edges[] = {1,2, 2,3, 3,4, 4,5, 1,5, 2,4};
+  long nStates[] = {2,3,2,3,2};
+  gm::GraphStorage<float> storage;
+  gm::makeGraph<float>(nNodes, nEdges, edges, nStates, storage);
+  gm::Graph<float> g = storage.graph();
+  long S = g.maxStates;
+
+  std::vector<float> nodePot, edgePot;
+  randomPotentials(g, nodePot, edgePot);
+
+  // every configuration, node 1 fastest
+  std::vector<float> Y, y(nNodes, 1);
+  do {
+    Y.insert(Y.end(), y.begin(), y.end());
+  } while (nextConfig(g, y));
+  long K = Y.size() / nNodes;
+  CHECK(K == 2*3*2*3*2);
+
+  std::vector<float> logPot(K), withTerms(K), nodeTerms(K*nNodes), edgeTerms(K*nEdges);
+  gm::logPotentialsForConfigs(g, &nodePot[0], &edgePot[0], K, &Y[0], &logPot[0], (float *)NULL, (float *)NULL);
+  gm::logPotentialsForConfigs(g, &nodePot[0], &edgePot[0], K, &Y[0], &withTerms[0],
+                              &nodeTerms[0], &edgeTerms[0]);
+  for (long k = 0; k < K; k++) {
+    const float *yk = &Y[k*nNodes];
+    CHECK_CLOSE(logPot[k], gm::logPotentialForConfig(g, &nodePot[0], &edgePot[0], yk), 1e-5);
+    CHECK(withTerms[k] == logPot[k]);
+
+    // terms: each factor's own log-potential, and they sum to the total
+    double sum = 0;
+    for (long n = 0; n < nNodes; n++) {
+      CHECK_CLOSE(nodeTerms[k*nNodes+n], log(nodePot[n*S+(long)yk[n]-1]), 1e-6);
+      sum += nodeTerms[k*nNodes+n];
+    }
+    for (long e = 0; e < nEdges; e++) {
+      long s1 = yk[edges[2*e]-1]-1, s2 = yk[edges[2*e+1]-1]-1;
+      CHECK_CLOSE(edgeTerms[k*nEdges+e], log(edgePot[(e*S+s1)*S+s2]), 1e-6);
+      sum += edgeTerms[k*nEdges+e];
+    }
+    CHECK_CLOSE(sum, logPot[k], 1e-5);
+  }
+
+  // a zero potential scores -inf, not NaN
+  nodePot[0] = 0;
+  gm::logPotentialsForConfigs(g, &nodePot[0], &edgePot[0], K, &Y[0], &logPot[0], (float *)NULL, (float *)NULL);
+  CHECK(logPot[0] == -HUGE_VAL && logPot[1] > -HUGE_VAL);
+
+  return TEST_RESULT();
+}
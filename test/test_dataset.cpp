@@ -0,0 +1,123 @@
+// Dataset files: write/read round trips with shared and per-instance
+// topology, and rejection of truncated or corrupt files.
+
+#include "gm_test.h"
+
+#include <string.h>
+#include <unistd.h>
+
+static const char *kFile = "test_dataset.gmd";
+
+// reads the whole file
+static std::vector<char> readFile() {
+  std::vector<char> bytes;
+  FILE *f = fopen(kFile, "rb");
+  char buffer[4096];
+  size_t n;
+  while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0) bytes.insert(bytes.end(), buffer, buffer+n);
+  fclose(f);
+  return bytes;
+}
+
+static void writeFile(const std::vector<char> &bytes, long size) {
+  FILE *f = fopen(kFile, "wb");
+  fwrite(&bytes[0], 1, size, f);
+  fclose(f);
+}
+
+static bool opens() {
+  gm::Dataset *ds = new gm::Dataset();
+  bool ok = ds->open(kFile);
+  ds->release();
+  return ok;
+}
+
+int main() {
+  long nInstances = 3, N = 5, E = 4, F = 2, Fe = 3;
+
+  // shared topology
+  std::vector<float> Y(nInstances*N), Xnode(nInstances*F*N), Xedge(nInstances*Fe*E);
+  for (size_t i = 0; i < Y.size(); i++) Y[i] = 1 + i % 3;
+  for (size_t i = 0; i < Xnode.size(); i++) Xnode[i] = uniform();
+  for (size_t i = 0; i < Xedge.size(); i++) Xedge[i] = uniform();
+  gm::DatasetWriter writer;
+  CHECK(writer.open(kFile, sizeof(float), nInstances, N, E, F, Fe, false));
+  for (long i = 0; i < nInstances; i++) {
+    CHECK(writer.add(&Y[i*N], &Xnode[i*F*N], &Xedge[i*Fe*E], N, E, NULL));
+  }
+  CHECK(!writer.add(&Y[0], &Xnode[0], &Xedge[0], N, E, NULL));
+  CHECK(writer.close());
+
+  gm::Dataset *ds = new gm::Dataset();
+  CHECK(ds->open(kFile));
+  CHECK(ds->info().nInstances == nInstances);
+  for (long i = 0; i < nInstances; i++) {
+    gm::DatasetInstance inst = ds->instance(i);
+    CHECK(inst.nNodes == N && inst.nEdges == E && inst.edgeEnds == 0);
+    CHECK(memcmp(ds->data() + inst.y, &Y[i*N], N*sizeof(float)) == 0);
+    CHECK(memcmp(ds->data() + inst.Xnode, &Xnode[i*F*N], F*N*sizeof(float)) == 0);
+    CHECK(memcmp(ds->data() + inst.Xedge, &Xedge[i*Fe*E], Fe*E*sizeof(float)) == 0);
+  }
+  ds->prefetch(1, 2);
+  ds->release();
+
+  // truncated file
+  std::vector<char> bytes = readFile();
+  writeFile(bytes, bytes.size()-1);
+  CHECK(!opens());
+
+  // per-instance topology: instance i has i+3 nodes on a chain
+  CHECK(writer.open(kFile, sizeof(double), nInstances, N, E, F, Fe, true));
+  std::vector<std::vector<double> > records;
+  for (long i = 0; i < nInstances; i++) {
+    long n = i+3, e = n-1;
+    std::vector<double> y(n), xn(F*n), xe(Fe*e), ends(2*e);
+    for (long k = 0; k < n; k++) y[k] = 1 + k % 2;
+    for (long k = 0; k < F*n; k++) xn[k] = uniform();
+    for (long k = 0; k < Fe*e; k++) xe[k] = uniform();
+    for (long k = 0; k < e; k++) {
+      ends[2*k] = k+1;
+      ends[2*k+1] = k+2;
+    }
+    CHECK(writer.add(&y[0], &xn[0], &xe[0], n, e, &ends[0]));
+    std::vector<double> record(y);
+    record.insert(record.end(), xn.begin(), xn.end());
+    record.insert(record.end(), xe.begin(), xe.end());
+    record.insert(record.end(), ends.begin(), ends.end());
+    records.push_back(record);
+  }
+  CHECK(writer.close());
+
+  ds = new gm::Dataset();
+  CHECK(ds->open(kFile));
+  for (long i = 0; i < nInstances; i++) {
+    gm::DatasetInstance inst = ds->instance(i);
+    CHECK(inst.nNodes == i+3 && inst.nEdges == i+2);
+    CHECK(inst.Xnode == inst.y + (long)sizeof(double)*inst.nNodes);
+    CHECK(memcmp(ds->data() + inst.y, &records[i][0], records[i].size()*sizeof(double)) == 0);
+  }
+  long offsetIndex = ds->info().offsetIndex;
+  ds->release();
+
+  // corrupt index entries: negative offset, negative size, past the end
+  bytes = readFile();
+  int64_t *entry = (int64_t *)&bytes[offsetIndex + 3*sizeof(int64_t)];
+  int64_t saved[3] = {entry[0], entry[1], entry[2]};
+  entry[0] = -64;
+  writeFile(bytes, bytes.size());
+  CHECK(!opens());
+  entry[0] = saved[0];
+  entry[2] = -1;
+  writeFile(bytes, bytes.size());
+  CHECK(!opens());
+  entry[2] = saved[2];
+  entry[0] = bytes.size();
+  writeFile(bytes, bytes.size());
+  CHECK(!opens());
+  entry[0] = saved[0];
+  writeFile(bytes, bytes.size());
+  CHECK(opens());
+
+  unlink(kFile);
+  return TEST_RESULT();
+}
@@ -0,0 +1,107 @@
+// Generated edge features: for each recipe, edge potentials and every CRF
+// objective (nll, pseudo, piecewise, margin) match the same features
+// materialized as an Xedge tensor.
+
+#include "gm_test.h"
+
+int main() {
+  srand(12);
+  long nNodes = 5, nEdges = 6, nInstances = 3, Fn = 2;
+  long edges[] = {1,2, 2,3, 3,4, 4,5, 1,5, 2,4};
+  long nStates[] = {3,2,3,2,3};
+  gm::GraphStorage<double> storage;
+  gm::makeGraph<double>(nNodes, nEdges, edges, nStates, storage);
+  gm::Graph<double> g = storage.graph();
+  long S = g.maxStates;
+
+  std::vector<double> Xnode(nInstances*Fn*nNodes), Y(nInstances*nNodes);
+  for (size_t i = 0; i < Xnode.size(); i++) Xnode[i] = uniform() - 0.5;
+  for (long i = 0; i < nInstances*nNodes; i++) Y[i] = 1 + rand() % nStates[i % nNodes];
+  std::vector<double> nodeMap(nNodes*S*Fn, 0);
+  for (long n = 0; n < nNodes; n++) {
+    for (long s = 0; s < nStates[n]; s++) {
+      for (long f = 0; f < Fn; f++) nodeMap[(n*S+s)*Fn+f] = 1+s*Fn+f;
+    }
+  }
+
+  for (int recipe = gm::kEdgeBias; recipe <= gm::kEdgeConcat; recipe++) {
+    gm::EdgeFeatures<double> generated = {recipe, &Xnode[0], Fn};
+    long F = gm::edgeFeatureCount(generated);
+    CHECK(F == (recipe == gm::kEdgeBias ? 1 : recipe == gm::kEdgeAbsDiff ? 1+Fn : 1+2*Fn));
+
+    // the same features, materialized (F x E per instance)
+    std::vector<double> Xedge(nInstances*F*nEdges);
+    for (long i = 0; i < nInstances; i++) {
+      const double *x = &Xnode[i*Fn*nNodes];
+      double *xe = &Xedge[i*F*nEdges];
+      for (long e = 0; e < nEdges; e++) {
+        long n1 = edges[2*e]-1, n2 = edges[2*e+1]-1;
+        xe[e] = 1;
+        for (long f = 0; f < Fn; f++) {
+          if (recipe == gm::kEdgeAbsDiff) xe[(1+f)*nEdges+e] = fabs(x[f*nNodes+n1] - x[f*nNodes+n2]);
+          if (recipe == gm::kEdgeConcat) {
+            xe[(1+f)*nEdges+e] = x[f*nNodes+n1];
+            xe[(1+Fn+f)*nEdges+e] = x[f*nNodes+n2];
+          }
+        }
+      }
+    }
+    gm::EdgeFeatures<double> materialized = {0, &Xedge[0], F};
+
+    long nParams = S*Fn + S*S*F;
+    std::vector<double> w(nParams), edgeMap(nEdges*S*S*F, 0);
+    for (long p = 0; p < nParams; p++) w[p] = uniform() - 0.5;
+    for (long e = 0; e < nEdges; e++) {
+      for (long i = 0; i < S*S; i++) {
+        for (long f = 0; f < F; f++) edgeMap[(e*S*S+i)*F+f] = 1+S*Fn+i*F+f;
+      }
+    }
+
+    // edge potentials of the first instance
+    std::vector<double> ep1(nEdges*S*S), ep2(nEdges*S*S);
+    gm::crfMakeEdgePotentials(g, materialized, &edgeMap[0], &w[0], &ep1[0]);
+    gm::crfMakeEdgePotentials(g, generated, &edgeMap[0], &w[0], &ep2[0]);
+    for (long i = 0; i < nEdges*S*S; i++) CHECK_CLOSE(ep2[i], ep1[i], 1e-12);
+
+    // objectives and gradients
+    for (int objective = 0; objective < 3; objective++) {
+      std::vector<double> g1(nParams, 0), g2(nParams, 0);
+      double f1, f2;
+      if (objective == 0) {
+        CHECK(gm::crfNll(g, &w[0], nParams, &nodeMap[0], &edgeMap[0], 20, nInstances, &Y[0],
+                         &Xnode[0], Fn, materialized, &f1, &g1[0]));
+        CHECK(gm::crfNll(g, &w[0], nParams, &nodeMap[0], &edgeMap[0], 20, nInstances, &Y[0],
+                         &Xnode[0], Fn, generated, &f2, &g2[0]));
+      } else if (objective == 1) {
+        f1 = gm::crfPseudoNll(g, &w[0], nParams, &nodeMap[0], &edgeMap[0], nInstances, &Y[0],
+                              &Xnode[0], Fn, materialized, &g1[0]);
+        f2 = gm::crfPseudoNll(g, &w[0], nParams, &nodeMap[0], &edgeMap[0], nInstances, &Y[0],
+                              &Xnode[0], Fn, generated, &g2[0]);
+      } else {
+        f1 = gm::crfPiecewiseNll(g, &w[0], nParams, &nodeMap[0], &edgeMap[0], nInstances, &Y[0],
+                                 &Xnode[0], Fn, materialized, &g1[0]);
+        f2 = gm::crfPiecewiseNll(g, &w[0], nParams, &nodeMap[0], &edgeMap[0], nInstances, &Y[0],
+                                 &Xnode[0], Fn, generated, &g2[0]);
+      }
+      CHECK_CLOSE(f2, f1, 1e-9);
+      for (long p = 0; p < nParams; p++) CHECK_CLOSE(g2[p], g1[p], 1e-9);
+    }
+
+    // max-margin: decoding, and loss
+    std::vector<double> Yhat1(nInstances*nNodes), Yhat2(nInstances*nNodes);
+    CHECK(gm::crfMarginDecode(g, (gm::JunctionTree *)NULL, &w[0], &nodeMap[0], &edgeMap[0], 20,
+                              nInstances, &Y[0], &Xnode[0], Fn, materialized, &Yhat1[0]));
+    CHECK(gm::crfMarginDecode(g, (gm::JunctionTree *)NULL, &w[0], &nodeMap[0], &edgeMap[0], 20,
+                              nInstances, &Y[0], &Xnode[0], Fn, generated, &Yhat2[0]));
+    CHECK(Yhat1 == Yhat2);
+    std::vector<double> g1(nParams, 0), g2(nParams, 0);
+    double f1 = gm::crfMarginLoss(g, &w[0], nParams, &nodeMap[0], &edgeMap[0], nInstances, &Y[0],
+                                  &Yhat1[0], &Xnode[0], Fn, materialized, &g1[0]);
+    double f2 = gm::crfMarginLoss(g, &w[0], nParams, &nodeMap[0], &edgeMap[0], nInstances, &Y[0],
+                                  &Yhat1[0], &Xnode[0], Fn, generated, &g2[0]);
+    CHECK_CLOSE(f2, f1, 1e-9);
+    for (long p = 0; p < nParams; p++) CHECK_CLOSE(g2[p], g1[p], 1e-9);
+  }
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,73 @@
+// Core kernels on a small tree, where belief propagation is exact:
+// config scoring, sum-product inference, max-product decoding and the
+// CRF negative log-likelihood, against brute force.
+
+#include "gm_test.h"
+
+int main() {
+  srand(1);
+  long nNodes = 6, nEdges = 5;
+  long edges[] = {1,2, 2,3, 2,4, 4,5, 4,6};
+  long nStates[] = {3,2,3,3,2,3};
+  gm::GraphStorage<double> storage;
+  gm::makeGraph<double>(nNodes, nEdges, edges, nStates, storage);
+  gm::Graph<double> g = storage.graph();
+  long S = g.maxStates;
+  CHECK(S == 3);
+  CHECK(g.V[nNodes] - 1 == 2*nEdges);
+
+  std::vector<double> nodePot, edgePot;
+  randomPotentials(g, nodePot, edgePot);
+  std::vector<double> exactNode, exactEdge, map;
+  double exactLogZ = bruteForce(g, &nodePot[0], &edgePot[0], exactNode, exactEdge, map);
+
+  // scoring
+  std::vector<double> y(nNodes, 1);
+  do {
+    double p = gm::potentialForConfig(g, &nodePot[0], &edgePot[0], &y[0]);
+    CHECK_CLOSE(gm::logPotentialForConfig(g, &nodePot[0], &edgePot[0], &y[0]), log(p), 1e-12);
+  } while (nextConfig(g, y));
+
+  // sum-product
+  std::vector<double> nodeBel(nNodes*S), edgeBel(nEdges*S*S);
+  double logZ;
+  CHECK(gm::inferBP(g, &nodePot[0], &edgePot[0], 10, &nodeBel[0], &edgeBel[0], &logZ) > 0);
+  CHECK_CLOSE(logZ, exactLogZ, 1e-6);
+  for (long i = 0; i < nNodes*S; i++) CHECK_CLOSE(nodeBel[i], exactNode[i], 1e-6);
+  for (long i = 0; i < nEdges*S*S; i++) CHECK_CLOSE(edgeBel[i], exactEdge[i], 1e-6);
+
+  // max-product
+  std::vector<long> config(nNodes);
+  CHECK(gm::decodeBP(g, &nodePot[0], &edgePot[0], 10, &nodeBel[0], &config[0]) > 0);
+  for (long n = 0; n < nNodes; n++) CHECK(config[n] == map[n]);
+
+  // CRF nll with one node and one edge feature: nll = log(Z) - score(y)
+  long nParams = S + S*S;
+  std::vector<double> w(nParams), nodeMap(nNodes*S, 0), edgeMap(nEdges*S*S, 0);
+  for (long p = 0; p < nParams; p++) w[p] = 2*uniform()-1;
+  for (long n = 0; n < nNodes; n++) {
+    for (long s = 0; s < nStates[n]; s++) nodeMap[n*S+s] = 1+s;
+  }
+  for (long e = 0; e < nEdges; e++) {
+    for (long s1 = 0; s1 < S; s1++) {
+      for (long s2 = 0; s2 < S; s2++) edgeMap[(e*S+s1)*S+s2] = 1+S+s1*S+s2;
+    }
+  }
+  std::vector<double> Xnode(nNodes), Xedge(nEdges), label(nNodes);
+  for (long n = 0; n < nNodes; n++) {
+    Xnode[n] = uniform();
+    label[n] = 1 + rand() % nStates[n];
+  }
+  for (long e = 0; e < nEdges; e++) Xedge[e] = uniform();
+  gm::EdgeFeatures<double> features = {0, &Xedge[0], 1};
+  gm::crfMakeNodePotentials(g, &Xnode[0], 1, &nodeMap[0], &w[0], &nodePot[0]);
+  gm::crfMakeEdgePotentials(g, features, &edgeMap[0], &w[0], &edgePot[0]);
+  exactLogZ = bruteForce(g, &nodePot[0], &edgePot[0], exactNode, exactEdge, map);
+  double nll;
+  std::vector<double> grad(nParams, 0);
+  CHECK(gm::crfNll(g, &w[0], nParams, &nodeMap[0], &edgeMap[0], 10, 1, &label[0],
+                   &Xnode[0], 1, features, &nll, &grad[0]));
+  CHECK_CLOSE(nll, exactLogZ - gm::logPotentialForConfig(g, &nodePot[0], &edgePot[0], &label[0]), 1e-6);
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,60 @@
+// Junction trees on a loopy graph (a 3 x 3 grid with a chord), with both
+// triangulation heuristics: clique structure, and exact log(Z), beliefs
+// and MAP against brute force.
+
+#include "gm_test.h"
+
+int main() {
+  srand(5);
+  long nNodes = 9, nEdges = 13;
+  long edges[] = {1,2, 2,3, 4,5, 5,6, 7,8, 8,9,
+                  1,4, 4,7, 2,5, 5,8, 3,6, 6,9, 1,9};
+  long nStates[] = {2,3,2,3,2,2,3,2,2};
+  gm::GraphStorage<double> storage;
+  gm::makeGraph<double>(nNodes, nEdges, edges, nStates, storage);
+  gm::Graph<double> g = storage.graph();
+  long S = g.maxStates;
+
+  std::vector<double> nodePot, edgePot;
+  randomPotentials(g, nodePot, edgePot);
+  std::vector<double> exactNode, exactEdge, map;
+  double exactLogZ = bruteForce(g, &nodePot[0], &edgePot[0], exactNode, exactEdge, map);
+
+  for (int heuristic = gm::kMinFill; heuristic <= gm::kMinDegree; heuristic++) {
+    gm::JunctionTree jt;
+    gm::makeJunctionTree(g, heuristic, jt);
+
+    // every node eliminated once, cliques consistent with cost and width
+    std::vector<long> seen(nNodes, 0);
+    double cost = 0;
+    long width = 0;
+    for (long i = 0; i < nNodes; i++) {
+      seen[jt.order[i]]++;
+      CHECK(jt.nodeClique[jt.order[i]] == i);
+      CHECK(jt.nodes[jt.offset[i]] == jt.order[i]);
+      CHECK(jt.parent[i] < 0 || jt.parent[i] > i);
+      double size = 1;
+      for (long k = jt.offset[i]; k < jt.offset[i+1]; k++) size *= nStates[jt.nodes[k]];
+      cost += size;
+      width = std::max(width, jt.offset[i+1] - jt.offset[i] - 1);
+    }
+    for (long n = 0; n < nNodes; n++) CHECK(seen[n] == 1);
+    CHECK_CLOSE(jt.cost, cost, 1e-6);
+    CHECK(jt.width == width && width >= 2);
+
+    // sum-product
+    std::vector<double> nodeBel(nNodes*S), edgeBel(nEdges*S*S);
+    double logZ;
+    CHECK(gm::inferJunctionTree(g, jt, &nodePot[0], &edgePot[0], &nodeBel[0], &edgeBel[0], &logZ));
+    CHECK_CLOSE(logZ, exactLogZ, 1e-9);
+    for (long i = 0; i < nNodes*S; i++) CHECK_CLOSE(nodeBel[i], exactNode[i], 1e-9);
+    for (long i = 0; i < nEdges*S*S; i++) CHECK_CLOSE(edgeBel[i], exactEdge[i], 1e-9);
+
+    // max-product
+    std::vector<long> config(nNodes);
+    CHECK(gm::decodeJunctionTree(g, jt, &nodePot[0], &edgePot[0], &config[0]));
+    for (long n = 0; n < nNodes; n++) CHECK(config[n] == map[n]);
+  }
+
+  return TEST_RESULT();
+}
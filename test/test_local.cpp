@@ -0,0 +1,109 @@
+// Pseudo-likelihood and piecewise likelihood of a CRF on a loopy graph,
+// against their definitions, and their gradients against finite
+// differences.
+
+#include "gm_test.h"
+
+// log of the sum of exp(x) over n values
+static double logSumExp(const double *x, long n) {
+  double m = x[0], sum = 0;
+  for (long i = 1; i < n; i++) if (x[i] > m) m = x[i];
+  for (long i = 0; i < n; i++) sum += exp(x[i] - m);
+  return m + log(sum);
+}
+
+int main() {
+  srand(2);
+  long nNodes = 4, nEdges = 5, nInstances = 3, F = 2;
+  long edges[] = {1,2, 2,3, 3,4, 1,4, 1,3};
+  long nStates[] = {2,3,2,3};
+  gm::GraphStorage<double> storage;
+  gm::makeGraph<double>(nNodes, nEdges, edges, nStates, storage);
+  gm::Graph<double> g = storage.graph();
+  long S = g.maxStates;
+
+  // per-state node parameters, and per-state-pair edge parameters
+  long nParams = S*F + S*S*F;
+  std::vector<double> w(nParams), nodeMap(nNodes*S*F, 0), edgeMap(nEdges*S*S*F, 0);
+  for (long p = 0; p < nParams; p++) w[p] = 2*uniform()-1;
+  for (long n = 0; n < nNodes; n++) {
+    for (long s = 0; s < nStates[n]; s++) {
+      for (long f = 0; f < F; f++) nodeMap[(n*S+s)*F+f] = 1+s*F+f;
+    }
+  }
+  for (long e = 0; e < nEdges; e++) {
+    for (long i = 0; i < S*S; i++) {
+      for (long f = 0; f < F; f++) edgeMap[(e*S*S+i)*F+f] = 1+S*F+i*F+f;
+    }
+  }
+  std::vector<double> Y(nInstances*nNodes), Xnode(nInstances*F*nNodes), Xedge(nInstances*F*nEdges);
+  for (long i = 0; i < nInstances*nNodes; i++) Y[i] = 1 + rand() % nStates[i % nNodes];
+  for (size_t i = 0; i < Xnode.size(); i++) Xnode[i] = uniform();
+  for (size_t i = 0; i < Xedge.size(); i++) Xedge[i] = uniform();
+  gm::EdgeFeatures<double> features = {0, &Xedge[0], F};
+
+  // definitions, from the potentials of each instance
+  std::vector<double> nodePot(nNodes*S), edgePot(nEdges*S*S);
+  double pseudo = 0, piecewise = 0;
+  for (long i = 0; i < nInstances; i++) {
+    gm::EdgeFeatures<double> xe = {0, &Xedge[i*F*nEdges], F};
+    gm::crfMakeNodePotentials(g, &Xnode[i*F*nNodes], F, &nodeMap[0], &w[0], &nodePot[0]);
+    gm::crfMakeEdgePotentials(g, xe, &edgeMap[0], &w[0], &edgePot[0]);
+    std::vector<double> y(&Y[i*nNodes], &Y[(i+1)*nNodes]);
+    double score = gm::logPotentialForConfig(g, &nodePot[0], &edgePot[0], &y[0]);
+
+    // -log p(y_n | rest): the other factors cancel out
+    for (long n = 0; n < nNodes; n++) {
+      std::vector<double> scores(nStates[n]);
+      for (long s = 0; s < nStates[n]; s++) {
+        std::vector<double> ys(y);
+        ys[n] = s+1;
+        scores[s] = gm::logPotentialForConfig(g, &nodePot[0], &edgePot[0], &ys[0]);
+      }
+      pseudo += logSumExp(&scores[0], nStates[n]) - score;
+    }
+
+    // every node and edge potential normalized on its own
+    for (long n = 0; n < nNodes; n++) {
+      std::vector<double> scores(nStates[n]);
+      for (long s = 0; s < nStates[n]; s++) scores[s] = log(nodePot[n*S+s]);
+      piecewise += logSumExp(&scores[0], nStates[n]) - scores[(long)y[n]-1];
+    }
+    for (long e = 0; e < nEdges; e++) {
+      long n1 = edges[2*e]-1, n2 = edges[2*e+1]-1;
+      std::vector<double> scores;
+      for (long s1 = 0; s1 < nStates[n1]; s1++) {
+        for (long s2 = 0; s2 < nStates[n2]; s2++) scores.push_back(log(edgePot[(e*S+s1)*S+s2]));
+      }
+      double label = log(edgePot[(e*S+(long)y[n1]-1)*S+(long)y[n2]-1]);
+      piecewise += logSumExp(&scores[0], scores.size()) - label;
+    }
+  }
+
+  for (int kind = 0; kind < 2; kind++) {
+    std::vector<double> grad(nParams, 0), scratch(nParams);
+    double nll = kind == 0
+      ? gm::crfPseudoNll(g, &w[0], nParams, &nodeMap[0], &edgeMap[0], nInstances, &Y[0],
+                         &Xnode[0], F, features, &grad[0])
+      : gm::crfPiecewiseNll(g, &w[0], nParams, &nodeMap[0], &edgeMap[0], nInstances, &Y[0],
+                            &Xnode[0], F, features, &grad[0]);
+    CHECK_CLOSE(nll, kind == 0 ? pseudo : piecewise, 1e-9);
+
+    // central differences
+    for (long p = 0; p < nParams; p++) {
+      double h = 1e-5, f[2];
+      for (int k = 0; k < 2; k++) {
+        w[p] += k ? -2*h : h;
+        f[k] = kind == 0
+          ? gm::crfPseudoNll(g, &w[0], nParams, &nodeMap[0], &edgeMap[0], nInstances, &Y[0],
+                             &Xnode[0], F, features, &scratch[0])
+          : gm::crfPiecewiseNll(g, &w[0], nParams, &nodeMap[0], &edgeMap[0], nInstances, &Y[0],
+                                &Xnode[0], F, features, &scratch[0]);
+      }
+      w[p] += h;
+      CHECK_CLOSE((f[0] - f[1]) / (2*h), grad[p], 1e-6);
+    }
+  }
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,83 @@
+// Max-margin objective of a CRF on a loopy graph: loss-augmented decoding
+// on a junction tree against brute force, the structured hinge loss
+// against its definition, and its subgradient against finite differences.
+
+#include "gm_test.h"
+
+int main() {
+  srand(8);
+  long nNodes = 4, nEdges = 5, nInstances = 3, F = 2;
+  long edges[] = {1,2, 2,3, 3,4, 1,4, 1,3};
+  long nStates[] = {2,3,2,3};
+  gm::GraphStorage<double> storage;
+  gm::makeGraph<double>(nNodes, nEdges, edges, nStates, storage);
+  gm::Graph<double> g = storage.graph();
+  long S = g.maxStates;
+
+  long nParams = S*F + S*S*F;
+  std::vector<double> w(nParams), nodeMap(nNodes*S*F, 0), edgeMap(nEdges*S*S*F, 0);
+  for (long p = 0; p < nParams; p++) w[p] = 4*uniform()-2;
+  for (long n = 0; n < nNodes; n++) {
+    for (long s = 0; s < nStates[n]; s++) {
+      for (long f = 0; f < F; f++) nodeMap[(n*S+s)*F+f] = 1+s*F+f;
+    }
+  }
+  for (long e = 0; e < nEdges; e++) {
+    for (long i = 0; i < S*S; i++) {
+      for (long f = 0; f < F; f++) edgeMap[(e*S*S+i)*F+f] = 1+S*F+i*F+f;
+    }
+  }
+  std::vector<double> Y(nInstances*nNodes), Xnode(nInstances*F*nNodes), Xedge(nInstances*F*nEdges);
+  for (long i = 0; i < nInstances*nNodes; i++) Y[i] = 1 + rand() % nStates[i % nNodes];
+  for (size_t i = 0; i < Xnode.size(); i++) Xnode[i] = uniform();
+  for (size_t i = 0; i < Xedge.size(); i++) Xedge[i] = uniform();
+  gm::EdgeFeatures<double> features = {0, &Xedge[0], F};
+
+  gm::JunctionTree jt;
+  gm::makeJunctionTree(g, gm::kMinFill, jt);
+  std::vector<double> Yhat(nInstances*nNodes);
+  CHECK(gm::crfMarginDecode(g, &jt, &w[0], &nodeMap[0], &edgeMap[0], 10, nInstances, &Y[0],
+                            &Xnode[0], F, features, &Yhat[0]));
+
+  // brute force: max over y' of score(y') + hamming(y, y') - score(y)
+  std::vector<double> nodePot(nNodes*S), edgePot(nEdges*S*S);
+  double loss = 0;
+  for (long i = 0; i < nInstances; i++) {
+    gm::EdgeFeatures<double> xe = {0, &Xedge[i*F*nEdges], F};
+    gm::crfMakeNodePotentials(g, &Xnode[i*F*nNodes], F, &nodeMap[0], &w[0], &nodePot[0]);
+    gm::crfMakeEdgePotentials(g, xe, &edgeMap[0], &w[0], &edgePot[0]);
+    const double *y = &Y[i*nNodes];
+    double best = -HUGE_VAL;
+    std::vector<double> yp(nNodes, 1);
+    do {
+      double value = gm::logPotentialForConfig(g, &nodePot[0], &edgePot[0], &yp[0]);
+      for (long n = 0; n < nNodes; n++) value += yp[n] != y[n];
+      if (value > best) best = value;
+    } while (nextConfig(g, yp));
+
+    // the decoded labeling reaches the maximum
+    double value = gm::logPotentialForConfig(g, &nodePot[0], &edgePot[0], &Yhat[i*nNodes]);
+    for (long n = 0; n < nNodes; n++) value += Yhat[i*nNodes+n] != y[n];
+    CHECK_CLOSE(value, best, 1e-9);
+    loss += best - gm::logPotentialForConfig(g, &nodePot[0], &edgePot[0], y);
+  }
+
+  std::vector<double> grad(nParams, 0), scratch(nParams);
+  double f = gm::crfMarginLoss(g, &w[0], nParams, &nodeMap[0], &edgeMap[0], nInstances, &Y[0],
+                               &Yhat[0], &Xnode[0], F, features, &grad[0]);
+  CHECK_CLOSE(f, loss, 1e-9);
+
+  // for a fixed Yhat, the loss is linear in w
+  for (long p = 0; p < nParams; p++) {
+    double h = 1e-3, fp[2];
+    for (int k = 0; k < 2; k++) {
+      w[p] += k ? -2*h : h;
+      fp[k] = gm::crfMarginLoss(g, &w[0], nParams, &nodeMap[0], &edgeMap[0], nInstances, &Y[0],
+                                &Yhat[0], &Xnode[0], F, features, &scratch[0]);
+    }
+    w[p] += h;
+    CHECK_CLOSE((fp[0] - fp[1]) / (2*h), grad[p], 1e-6);
+  }
+
+  return TEST_RESULT();
+}
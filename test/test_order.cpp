@@ -0,0 +1,82 @@
+// Node orderings on a forest with shuffled node numbers (a path, and a
+// star): valid permutations of nodes and edges, a renumbered topology
+// that matches the original, unit bandwidth on the path, and bp on the
+// renumbered graph giving the original beliefs once mapped back.
+
+#include "gm_test.h"
+
+#include <stdlib.h>
+
+int main() {
+  srand(6);
+  // path 7-2-9-4-1-6, star 3-{5,8,10}, numbered at random
+  long nNodes = 10, nEdges = 8;
+  long edges[] = {2,7, 2,9, 4,9, 1,4, 1,6, 3,5, 3,8, 3,10};
+  long path[] = {7,2,9,4,1,6};
+  long nStates[] = {2,3,2,2,3,2,3,2,2,3};
+  gm::GraphStorage<double> storage;
+  gm::makeGraph<double>(nNodes, nEdges, edges, nStates, storage);
+  gm::Graph<double> g = storage.graph();
+  long S = g.maxStates;
+
+  std::vector<double> nodePot, edgePot;
+  randomPotentials(g, nodePot, edgePot);
+  std::vector<double> nodeRef(nNodes*S), edgeRef(nEdges*S*S);
+  double logZRef;
+  CHECK(gm::inferBP(g, &nodePot[0], &edgePot[0], 10, &nodeRef[0], &edgeRef[0], &logZRef) > 0);
+
+  int orderings[] = {gm::kOrderBFS, gm::kOrderRCM};
+  for (int k = 0; k < 2; k++) {
+    std::vector<long> nodeOrder(nNodes), edgeOrder(nEdges);
+    gm::GraphStorage<double> ordered;
+    gm::orderGraph(g, orderings[k], &nodeOrder[0], &edgeOrder[0], ordered);
+    gm::Graph<double> og = ordered.graph();
+
+    // permutations, and their inverse
+    std::vector<long> newNode(nNodes, 0), seen(nEdges, 0);
+    for (long i = 0; i < nNodes; i++) newNode[nodeOrder[i]-1] = i+1;
+    for (long n = 0; n < nNodes; n++) CHECK(newNode[n] > 0);
+    for (long i = 0; i < nEdges; i++) seen[edgeOrder[i]-1]++;
+    for (long e = 0; e < nEdges; e++) CHECK(seen[e] == 1);
+
+    // same topology, edges in order of their lowest then highest end
+    CHECK(og.nNodes == nNodes && og.nEdges == nEdges && og.maxStates == S);
+    for (long i = 0; i < nNodes; i++) CHECK(og.nStates[i] == nStates[nodeOrder[i]-1]);
+    for (long i = 0; i < nEdges; i++) {
+      long e = edgeOrder[i]-1;
+      CHECK(nodeOrder[(long)og.edgeEnds[i*2+0]-1] == edges[e*2+0]);
+      CHECK(nodeOrder[(long)og.edgeEnds[i*2+1]-1] == edges[e*2+1]);
+      if (i > 0) {
+        long lo = std::min(og.edgeEnds[i*2], og.edgeEnds[i*2+1]);
+        long hi = std::max(og.edgeEnds[i*2], og.edgeEnds[i*2+1]);
+        long plo = std::min(og.edgeEnds[i*2-2], og.edgeEnds[i*2-1]);
+        long phi = std::max(og.edgeEnds[i*2-2], og.edgeEnds[i*2-1]);
+        CHECK(plo < lo || (plo == lo && phi < hi));
+      }
+    }
+
+    // from a peripheral node, the path gets consecutive numbers
+    for (long i = 1; i < 6; i++) CHECK(labs(newNode[path[i]-1] - newNode[path[i-1]-1]) == 1);
+
+    // bp on the renumbered copies, mapped back
+    std::vector<double> np(nNodes*S), ep(nEdges*S*S);
+    for (long i = 0; i < nNodes; i++) {
+      for (long s = 0; s < S; s++) np[i*S+s] = nodePot[(nodeOrder[i]-1)*S+s];
+    }
+    for (long i = 0; i < nEdges; i++) {
+      for (long s = 0; s < S*S; s++) ep[i*S*S+s] = edgePot[(edgeOrder[i]-1)*S*S+s];
+    }
+    std::vector<double> nodeBel(nNodes*S), edgeBel(nEdges*S*S);
+    double logZ;
+    CHECK(gm::inferBP(og, &np[0], &ep[0], 10, &nodeBel[0], &edgeBel[0], &logZ) > 0);
+    CHECK_CLOSE(logZ, logZRef, 1e-9);
+    for (long i = 0; i < nNodes; i++) {
+      for (long s = 0; s < S; s++) CHECK_CLOSE(nodeBel[i*S+s], nodeRef[(nodeOrder[i]-1)*S+s], 1e-9);
+    }
+    for (long i = 0; i < nEdges; i++) {
+      for (long s = 0; s < S*S; s++) CHECK_CLOSE(edgeBel[i*S*S+s], edgeRef[(edgeOrder[i]-1)*S*S+s], 1e-9);
+    }
+  }
+
+  return TEST_RESULT();
+}
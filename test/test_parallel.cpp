@@ -0,0 +1,52 @@
+// Worker pool: a few steps over forked workers, after the parent has run
+// OpenMP regions (workers must not deadlock in theirs), with per-worker
+// results and the gradient reduction checked.
+
+#include "gm_test.h"
+
+#include <unistd.h>
+
+int main() {
+  long nWorkers = 3, nParams = 100;
+
+  // start the parent's OpenMP threads before forking
+  double sum = 0;
+#pragma omp parallel for reduction(+:sum)
+  for (long i = 0; i < 1000; i++) sum += i;
+  CHECK(sum == 499500);
+
+  gm::WorkerPool pool;
+  CHECK(pool.create(nWorkers, nParams, sizeof(double)));
+  long worker = pool.spawn(false);
+  if (worker >= 0) {
+    // worker: nll = (worker+1) * sum(w), grad = (worker+1) * w
+    std::vector<double> w(nParams), grad(nParams);
+    long batchSize;
+    while (pool.next(worker, &w[0], &batchSize)) {
+      double nll = 0;
+#pragma omp parallel for reduction(+:nll)
+      for (long i = 0; i < nParams; i++) {
+        grad[i] = (worker+1) * w[i];
+        nll += grad[i];
+      }
+      pool.finish(worker, nll + batchSize, &grad[0], NULL);
+    }
+    _exit(0);
+  }
+  CHECK(worker == -1);
+
+  std::vector<double> w(nParams), grad(nParams);
+  for (int step = 0; step < 3; step++) {
+    for (long i = 0; i < nParams; i++) w[i] = uniform();
+    double nll, total = 0;
+    for (long i = 0; i < nParams; i++) total += w[i];
+    CHECK(pool.step(&w[0], step, &nll));
+    CHECK_CLOSE(nll, 6*total + nWorkers*step, 1e-9);
+    gm::reduceGradients(pool, &grad[0]);
+    for (long i = 0; i < nParams; i++) CHECK_CLOSE(grad[i], 6*w[i], 1e-12);
+  }
+  pool.stop();
+  CHECK(!pool.step(&w[0], 0, &sum));
+
+  return TEST_RESULT();
+}